@@ -0,0 +1,132 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/amatch.h"
+
+#define ENTRY_COUNT 10000
+#define MAX_SAMPLES 4096
+
+static const char *syllables[] = {
+    "ka", "lo", "mi", "ne", "ra", "ti", "vo", "xen", "qu", "ber",
+    "dor", "fi", "gra", "hul", "ja", "pex", "sor", "tum", "wy", "zel"
+};
+
+static const char *generic_names[] = {
+    "Web Browser", "Text Editor", "Terminal Emulator", "Image Viewer",
+    "File Manager", "Media Player", "Office Suite", "System Monitor"
+};
+
+static const char *real_names[][3] = {
+    { "Firefox", "Web Browser", "internet www browser web" },
+    { "LibreOffice Writer", "Word Processor", "text letter fax document" },
+    { "GNU Image Manipulation Program", "Image Editor", "gimp photo paint" },
+    { "Settings", "Control Center", "preferences configuration" },
+    { "XTerm", "Terminal", "shell prompt command" },
+    { "Fireworks Screensaver", "Screensaver", "fire particles" }
+};
+
+static const char *queries[] = {
+    "firefox", "libre writer", "gimp", "term", "settings", "kalomi", "zzqx"
+};
+
+static uint32_t rng_state = 2463534242u;
+
+static uint32_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static char *random_name(void) {
+    char buf[128] = "";
+    int words = 1 + next_random() % 3;
+
+    for (int w = 0; w < words; w++) {
+        if (w > 0) strcat(buf, " ");
+        int parts = 2 + next_random() % 3;
+        for (int p = 0; p < parts; p++) {
+            const char *s = syllables[next_random() % (sizeof(syllables) / sizeof(*syllables))];
+            size_t len = strlen(buf);
+            strcat(buf, s);
+            if (p == 0) buf[len] -= 'a' - 'A';
+        }
+    }
+    return strdup(buf);
+}
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int main(void) {
+    AMatcher *matcher = amatch_new();
+    char *names[ENTRY_COUNT];
+    size_t n_real = sizeof(real_names) / sizeof(*real_names);
+
+    double start = now_us();
+    for (size_t i = 0; i < ENTRY_COUNT; i++) {
+        if (i < n_real) {
+            names[i] = strdup(real_names[i][0]);
+            amatch_add(matcher, names[i], real_names[i][0], real_names[i][1], real_names[i][2]);
+        } else {
+            names[i] = random_name();
+            amatch_add(matcher, names[i], names[i],
+                       generic_names[next_random() % (sizeof(generic_names) / sizeof(*generic_names))], NULL);
+        }
+    }
+    double build_us = now_us() - start;
+
+    double samples[MAX_SAMPLES];
+    size_t n_samples = 0;
+    char query[256];
+
+    for (size_t q = 0; q < sizeof(queries) / sizeof(*queries); q++) {
+        size_t len = strlen(queries[q]);
+
+        for (size_t i = 1; i <= 2 * len; i++) {
+            size_t typed = i <= len ? i : 2 * len - i;
+            size_t n_results;
+
+            memcpy(query, queries[q], typed);
+            query[typed] = '\0';
+
+            double t0 = now_us();
+            amatch_query(matcher, query, &n_results);
+            samples[n_samples++] = now_us() - t0;
+        }
+    }
+
+    size_t n_results;
+    const AMatchResult *results = amatch_query(matcher, "fire", &n_results);
+    int ranked_ok = n_results > 0 && strcmp(results[0].data, "Firefox") == 0;
+
+    qsort(samples, n_samples, sizeof(double), compare_double);
+    double total = 0;
+    for (size_t i = 0; i < n_samples; i++) total += samples[i];
+
+    printf("amatch: %d entries indexed in %.0f us, %zu keystrokes\n",
+           ENTRY_COUNT, build_us, n_samples);
+    printf("  mean %.1f us  p50 %.1f us  p95 %.1f us  max %.1f us\n",
+           total / n_samples, samples[n_samples / 2],
+           samples[n_samples * 95 / 100], samples[n_samples - 1]);
+    printf("  \"fire\" ranks Firefox first: %s\n", ranked_ok ? "yes" : "NO");
+    printf("{\"bench\":\"amatch_keystroke\",\"entries\":%d,\"keystrokes\":%zu,"
+           "\"mean_us\":%.1f,\"p50_us\":%.1f,\"p95_us\":%.1f,\"max_us\":%.1f}\n",
+           ENTRY_COUNT, n_samples, total / n_samples, samples[n_samples / 2],
+           samples[n_samples * 95 / 100], samples[n_samples - 1]);
+
+    amatch_free(matcher);
+    for (size_t i = 0; i < ENTRY_COUNT; i++) free(names[i]);
+    return ranked_ok ? 0 : 1;
+}
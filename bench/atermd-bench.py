@@ -0,0 +1,299 @@
+#!/usr/bin/env python3
+"""Headless atermd benchmarks.
+
+Runs atermd under Xvfb with a throwaway HOME, drives it through its
+control socket and reads the Chrome trace it writes on exit (see
+ATERMD_TRACE). ATERMD_BENCH enables the control commands only the
+benchmarks use. Prints a summary and one JSON line per benchmark.
+"""
+
+import argparse
+import json
+import os
+import random
+import shutil
+import socket
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+APP_COUNTS = (100, 1000, 10000)
+STARTUP_RUNS = 5
+MENU_OPENS = 10
+FONT_CHANGES = 10
+SCROLLBACK_LINES = 10000
+THROUGHPUT_MB = 64
+QUERIES = ("firefox", "term", "kalomi", "settings", "zzqx")
+TIMEOUT = 30
+
+SYLLABLES = ("ka", "lo", "mi", "ne", "ra", "ti", "vo", "xen", "qu", "ber",
+             "dor", "fi", "gra", "hul", "ja", "pex", "sor", "tum", "wy", "zel")
+GENERIC_NAMES = ("Web Browser", "Text Editor", "Terminal Emulator", "Image Viewer",
+                 "File Manager", "Media Player", "Office Suite", "System Monitor")
+CATEGORIES = ("Network", "Utility", "Development", "Graphics", "AudioVideo",
+              "Office", "Settings", "System", "Game")
+REAL_APPS = (("Firefox", "Web Browser", "internet;www;browser;web;"),
+             ("XTerm", "Terminal", "shell;prompt;command;"),
+             ("Settings", "Control Center", "preferences;configuration;"))
+
+
+class BenchError(Exception):
+    pass
+
+
+def wait_for(predicate, timeout=TIMEOUT, interval=0.005):
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        if predicate():
+            return True
+        time.sleep(interval)
+    return False
+
+
+def start_xvfb():
+    if not shutil.which("Xvfb"):
+        raise BenchError("Xvfb not found; install xvfb to run the benchmarks")
+
+    for number in range(99, 160):
+        if os.path.exists("/tmp/.X%d-lock" % number):
+            continue
+        proc = subprocess.Popen(["Xvfb", ":%d" % number, "-screen", "0", "1920x1080x24",
+                                 "-nolisten", "tcp"],
+                                stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        if wait_for(lambda: os.path.exists("/tmp/.X11-unix/X%d" % number), timeout=10):
+            return proc, ":%d" % number
+        proc.kill()
+        proc.wait()
+    raise BenchError("could not start Xvfb")
+
+
+def random_name(rng):
+    words = []
+    for _ in range(rng.randint(1, 3)):
+        word = "".join(rng.choice(SYLLABLES) for _ in range(rng.randint(2, 4)))
+        words.append(word.capitalize())
+    return " ".join(words)
+
+
+def write_apps(data_dir, count):
+    apps_dir = os.path.join(data_dir, "applications")
+    os.makedirs(apps_dir)
+    rng = random.Random(2463534242)
+
+    for i in range(count):
+        if i < len(REAL_APPS):
+            name, generic, keywords = REAL_APPS[i]
+        else:
+            name, generic, keywords = random_name(rng), rng.choice(GENERIC_NAMES), ""
+        with open(os.path.join(apps_dir, "bench-%05d.desktop" % i), "w") as f:
+            f.write("[Desktop Entry]\nType=Application\n")
+            f.write("Name=%s\nGenericName=%s\nKeywords=%s\n" % (name, generic, keywords))
+            f.write("Categories=%s;\nExec=true\n" % rng.choice(CATEGORIES))
+
+
+class ATermD:
+    def __init__(self, binary, root, display, data_dir):
+        self.root = tempfile.mkdtemp(dir=root)
+        home = os.path.join(self.root, "home")
+        runtime = os.path.join(self.root, "run")
+        config_dir = os.path.join(home, ".config", "alinuxd")
+        os.makedirs(config_dir)
+        os.makedirs(runtime, mode=0o700)
+        with open(os.path.join(config_dir, "conf.ini"), "w") as f:
+            f.write("[Settings]\nfont_size=16\nshell=/bin/sh\n\n"
+                    "[Scrollback]\nlines=%d\n" % SCROLLBACK_LINES)
+
+        self.trace_path = os.path.join(self.root, "trace.json")
+        self.socket_path = os.path.join(runtime, "atermd.sock")
+        env = dict(os.environ, HOME=home, XDG_RUNTIME_DIR=runtime,
+                   XDG_CONFIG_HOME=os.path.join(home, ".config"),
+                   XDG_CACHE_HOME=os.path.join(home, ".cache"),
+                   XDG_DATA_HOME=os.path.join(home, ".local", "share"),
+                   XDG_DATA_DIRS=data_dir, DISPLAY=display,
+                   ATERMD_TRACE=self.trace_path, ATERMD_BENCH="1",
+                   NO_AT_BRIDGE="1")
+
+        self.started = time.monotonic()
+        self.proc = subprocess.Popen([binary], env=env, stdout=subprocess.DEVNULL)
+        self.sock = None
+        if not wait_for(self.connect):
+            self.proc.kill()
+            raise BenchError("atermd did not open its control socket")
+        self.reader = self.sock.makefile("r")
+        self.command("switch 1")
+        self.ready = time.monotonic() - self.started
+
+    def connect(self):
+        if self.proc.poll() is not None:
+            raise BenchError("atermd exited with status %d" % self.proc.returncode)
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        try:
+            sock.connect(self.socket_path)
+        except OSError:
+            sock.close()
+            return False
+        sock.settimeout(TIMEOUT)
+        self.sock = sock
+        return True
+
+    def command(self, line):
+        start = time.monotonic()
+        self.sock.sendall((line + "\n").encode())
+        reply = self.reader.readline()
+        if not reply.startswith("ok"):
+            raise BenchError("%s: %s" % (line, reply.strip() or "no reply"))
+        return time.monotonic() - start
+
+    def run_until_done(self, script):
+        """Runs script in a new tab and waits until it has finished; the
+        shell then stays alive so the tab and its scrollback stay open."""
+        done = os.path.join(self.root, "done")
+        if os.path.exists(done):
+            os.unlink(done)
+        start = time.monotonic()
+        self.command("run sh -c '%s; touch %s; exec sleep 100000'" % (script, done))
+        if not wait_for(lambda: os.path.exists(done), timeout=300, interval=0.002):
+            raise BenchError("timed out running %s" % script)
+        return time.monotonic() - start
+
+    def quit(self):
+        self.sock.sendall(b"quit\n")
+        self.reader.readline()
+        self.sock.close()
+        try:
+            self.proc.wait(timeout=TIMEOUT)
+        except subprocess.TimeoutExpired:
+            self.proc.kill()
+            raise BenchError("atermd did not quit")
+        with open(self.trace_path) as f:
+            events = json.load(f)["traceEvents"]
+        spans = {}
+        for event in events:
+            if event.get("ph") == "X":
+                spans.setdefault(event["name"], []).append(event["dur"] / 1000.0)
+        return spans
+
+
+def summarize(name, samples, unit="ms", **extra):
+    samples = sorted(samples)
+    result = {"bench": name, "unit": unit, "samples": len(samples),
+              "mean": round(statistics.mean(samples), 3),
+              "p50": round(samples[len(samples) // 2], 3),
+              "p95": round(samples[len(samples) * 95 // 100], 3),
+              "max": round(samples[-1], 3)}
+    result.update(extra)
+    return result
+
+
+def bench_startup(args, root, display, data_dir):
+    first_frame, ready = [], []
+    for _ in range(STARTUP_RUNS):
+        atermd = ATermD(args.binary, root, display, data_dir)
+        ready.append(atermd.ready * 1000)
+        first_frame += atermd.quit().get("first-frame", [])
+    if not first_frame:
+        raise BenchError("no first-frame span in the trace")
+    return [summarize("startup_first_frame", first_frame),
+            summarize("startup_control_ready", ready)]
+
+
+def bench_amenu(args, root, display, data_dir, count):
+    atermd = ATermD(args.binary, root, display, data_dir)
+    round_trips = []
+    for query in QUERIES:
+        for typed in list(range(1, len(query) + 1)) + list(range(len(query) - 1, -1, -1)):
+            round_trips.append(atermd.command("amenu-query " + query[:typed]) * 1000)
+    atermd.command("amenu")
+
+    for _ in range(MENU_OPENS):
+        atermd.command("context-menu")
+    spans = atermd.quit()
+
+    results = [summarize("amenu_keystroke", spans["update_amenu_list"], apps=count),
+               summarize("amenu_keystroke_round_trip", round_trips, apps=count)]
+    menus = spans.get("show_context_menu", [])
+    if menus:
+        results.append(summarize("context_menu_open", menus[1:], apps=count, first=menus[0]))
+    return results
+
+
+def bench_terminal(args, root, display, data_dir):
+    atermd = ATermD(args.binary, root, display, data_dir)
+
+    atermd.run_until_done("seq 1 %d" % (SCROLLBACK_LINES * 2))
+    for i in range(FONT_CHANGES):
+        atermd.command("font %+d" % (1 if i % 2 == 0 else -1))
+        time.sleep(0.2)
+
+    path = os.path.join(atermd.root, "output.txt")
+    with open(path, "w") as f:
+        line = "".join(chr(ord("a") + i % 26) for i in range(79)) + "\n"
+        f.write(line * (THROUGHPUT_MB * 1024 * 1024 // len(line)))
+    seconds = atermd.run_until_done("cat %s" % path)
+
+    spans = atermd.quit()
+    frames = spans.get("font-change-to-frame")
+    if not frames:
+        raise BenchError("no font-change-to-frame span in the trace")
+    return [summarize("font_change_full_scrollback", frames, lines=SCROLLBACK_LINES),
+            {"bench": "output_throughput", "unit": "MB/s", "mb": THROUGHPUT_MB,
+             "seconds": round(seconds, 3), "value": round(THROUGHPUT_MB / seconds, 1)}]
+
+
+def print_result(result):
+    if "p50" in result:
+        print("%-30s p50 %8.2f %s  p95 %8.2f %s  max %8.2f %s  (n=%d)" % (
+            result["bench"] + (" [%d apps]" % result["apps"] if "apps" in result else ""),
+            result["p50"], result["unit"], result["p95"], result["unit"],
+            result["max"], result["unit"], result["samples"]))
+    else:
+        print("%-30s %.1f %s" % (result["bench"], result["value"], result["unit"]))
+    print(json.dumps(result))
+    sys.stdout.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--binary", default="src/atermd")
+    parser.add_argument("--output", help="also write all results to this JSON file")
+    args = parser.parse_args()
+    args.binary = os.path.abspath(args.binary)
+
+    root = tempfile.mkdtemp(prefix="atermd-bench-")
+    xvfb = None
+    results = []
+    try:
+        xvfb, display = start_xvfb()
+        data_dirs = {}
+        for count in APP_COUNTS:
+            data_dirs[count] = os.path.join(root, "data-%d" % count)
+            write_apps(data_dirs[count], count)
+
+        benches = [lambda: bench_startup(args, root, display, data_dirs[1000])]
+        benches += [lambda count=count: bench_amenu(args, root, display, data_dirs[count], count)
+                    for count in APP_COUNTS]
+        benches.append(lambda: bench_terminal(args, root, display, data_dirs[100]))
+        for bench in benches:
+            for result in bench():
+                print_result(result)
+                results.append(result)
+    except BenchError as e:
+        print("atermd-bench: %s" % e, file=sys.stderr)
+        return 1
+    finally:
+        if xvfb:
+            xvfb.terminate()
+            xvfb.wait()
+        shutil.rmtree(root, ignore_errors=True)
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump({"results": results}, f, indent=2)
+            f.write("\n")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
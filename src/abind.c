@@ -0,0 +1,334 @@
+#define _GNU_SOURCE
+#include <X11/Xlib.h>
+#include <X11/XKBlib.h>
+#include <X11/keysym.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CONFIG_DIR "/.config/.abind"
+#define CONFIG_NAME "conf"
+#define MAX_ARGS 64
+
+extern char **environ;
+
+typedef struct {
+    unsigned int modifiers;
+    KeyCode keycode;
+    char *command;
+} Binding;
+
+Display *display;
+Window root;
+Binding *bindings;
+int binding_count;
+unsigned int numlock_mask;
+KeyCode pressed_keycode;
+char config_dir[PATH_MAX - 16];
+char config_file[PATH_MAX];
+
+const char *default_config =
+    "[Ctrl+g]\n"
+    "firefox\n"
+    "[Ctrl+d]\n"
+    "dmenu\n";
+
+int on_x_error(Display *dpy, XErrorEvent *event) {
+    if (event->error_code == BadAccess) {
+        fprintf(stderr, "abind: key combination already grabbed by another client\n");
+    }
+    return 0;
+}
+
+void ensure_config_exists() {
+    const char *home = getenv("HOME");
+    snprintf(config_dir, sizeof(config_dir), "%s%s", home ? home : "", CONFIG_DIR);
+    snprintf(config_file, sizeof(config_file), "%s/%s", config_dir, CONFIG_NAME);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s", config_dir);
+    for (char *p = path + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            mkdir(path, 0755);
+            *p = '/';
+        }
+    }
+    mkdir(path, 0755);
+
+    if (access(config_file, F_OK) != 0) {
+        FILE *file = fopen(config_file, "w");
+        if (file) {
+            fputs(default_config, file);
+            fclose(file);
+        }
+    }
+}
+
+unsigned int find_numlock_mask() {
+    unsigned int mask = 0;
+    XModifierKeymap *map = XGetModifierMapping(display);
+    KeyCode numlock = XKeysymToKeycode(display, XK_Num_Lock);
+
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < map->max_keypermod; j++) {
+            if (numlock && map->modifiermap[i * map->max_keypermod + j] == numlock) {
+                mask = 1 << i;
+            }
+        }
+    }
+    XFreeModifiermap(map);
+    return mask;
+}
+
+char *trim(char *text) {
+    while (isspace((unsigned char)*text)) text++;
+    char *end = text + strlen(text);
+    while (end > text && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return text;
+}
+
+KeySym lookup_keysym(const char *name) {
+    char variant[64];
+    KeySym sym = XStringToKeysym(name);
+    if (sym != NoSymbol) return sym;
+
+    snprintf(variant, sizeof(variant), "%s", name);
+    for (char *p = variant; *p; p++) *p = tolower((unsigned char)*p);
+    sym = XStringToKeysym(variant);
+    if (sym != NoSymbol) return sym;
+
+    variant[0] = toupper((unsigned char)variant[0]);
+    return XStringToKeysym(variant);
+}
+
+int parse_combo(const char *combo, Binding *binding) {
+    char buf[256];
+    KeySym sym = NoSymbol;
+
+    snprintf(buf, sizeof(buf), "%s", combo);
+    binding->modifiers = 0;
+
+    for (char *part = strtok(buf, "+"); part; part = strtok(NULL, "+")) {
+        part = trim(part);
+        if (strcasecmp(part, "ctrl") == 0 || strcasecmp(part, "control") == 0) {
+            binding->modifiers |= ControlMask;
+        } else if (strcasecmp(part, "shift") == 0) {
+            binding->modifiers |= ShiftMask;
+        } else if (strcasecmp(part, "alt") == 0) {
+            binding->modifiers |= Mod1Mask;
+        } else if (strcasecmp(part, "super") == 0 || strcasecmp(part, "win") == 0) {
+            binding->modifiers |= Mod4Mask;
+        } else if (sym == NoSymbol) {
+            sym = lookup_keysym(part);
+        } else {
+            fprintf(stderr, "abind: only one non-modifier key is supported in [%s]\n", combo);
+            return 0;
+        }
+    }
+
+    binding->keycode = sym != NoSymbol ? XKeysymToKeycode(display, sym) : 0;
+    if (!binding->keycode) {
+        fprintf(stderr, "abind: unknown key in [%s]\n", combo);
+        return 0;
+    }
+    return 1;
+}
+
+void grab_binding(const Binding *binding, int grab) {
+    unsigned int ignored[] = { 0, LockMask, numlock_mask, LockMask | numlock_mask };
+
+    for (size_t i = 0; i < sizeof(ignored) / sizeof(*ignored); i++) {
+        if (i > 0 && !ignored[i]) continue;
+        if (grab) {
+            XGrabKey(display, binding->keycode, binding->modifiers | ignored[i], root,
+                     True, GrabModeAsync, GrabModeAsync);
+        } else {
+            XUngrabKey(display, binding->keycode, binding->modifiers | ignored[i], root);
+        }
+    }
+}
+
+void free_bindings() {
+    for (int i = 0; i < binding_count; i++) {
+        grab_binding(&bindings[i], 0);
+        free(bindings[i].command);
+    }
+    free(bindings);
+    bindings = NULL;
+    binding_count = 0;
+}
+
+void load_config() {
+    char line[1024];
+    char combo[256] = "";
+    int capacity = 0;
+
+    free_bindings();
+    numlock_mask = find_numlock_mask();
+
+    FILE *file = fopen(config_file, "r");
+    if (!file) return;
+
+    while (fgets(line, sizeof(line), file)) {
+        char *text = trim(line);
+        size_t len = strlen(text);
+
+        if (len >= 2 && text[0] == '[' && text[len - 1] == ']') {
+            text[len - 1] = '\0';
+            snprintf(combo, sizeof(combo), "%s", text + 1);
+        } else if (combo[0] && len > 0 && text[0] != '#') {
+            Binding binding;
+            if (parse_combo(combo, &binding)) {
+                if (binding_count == capacity) {
+                    capacity = capacity ? capacity * 2 : 8;
+                    bindings = realloc(bindings, capacity * sizeof(Binding));
+                }
+                binding.command = strdup(text);
+                bindings[binding_count++] = binding;
+                grab_binding(&binding, 1);
+            }
+            combo[0] = '\0';
+        }
+    }
+    fclose(file);
+    XSync(display, False);
+}
+
+int needs_shell(const char *command) {
+    return strpbrk(command, "|&;<>()$`\\\"'*?[#~=%\n") != NULL;
+}
+
+void run_command(const char *command) {
+    char *copy = strdup(command);
+    char *argv[MAX_ARGS];
+    int argc = 0;
+
+    if (needs_shell(command)) {
+        argv[argc++] = "/bin/sh";
+        argv[argc++] = "-c";
+        argv[argc++] = copy;
+    } else {
+        for (char *arg = strtok(copy, " \t"); arg && argc < MAX_ARGS - 1; arg = strtok(NULL, " \t")) {
+            argv[argc++] = arg;
+        }
+    }
+    argv[argc] = NULL;
+
+    /* Children get default signal handling back and their own session, so
+       they outlive abind and are not affected by its ignored SIGCHLD. */
+    posix_spawnattr_t attr;
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGCHLD);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSID);
+
+    pid_t pid;
+    int err = argc > 0 ? posix_spawnp(&pid, argv[0], NULL, &attr, argv, environ) : ENOENT;
+    if (err != 0) {
+        fprintf(stderr, "abind: failed to run '%s': %s\n", command, strerror(err));
+    }
+
+    posix_spawnattr_destroy(&attr);
+    free(copy);
+}
+
+void handle_key_press(XKeyEvent *event) {
+    unsigned int state = event->state & (ShiftMask | ControlMask | Mod1Mask | Mod4Mask);
+
+    if (event->keycode == pressed_keycode) return;
+    pressed_keycode = event->keycode;
+
+    for (int i = 0; i < binding_count; i++) {
+        if (bindings[i].keycode == event->keycode && bindings[i].modifiers == state) {
+            run_command(bindings[i].command);
+            break;
+        }
+    }
+}
+
+int config_changed(int inotify_fd) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    ssize_t len = read(inotify_fd, buf, sizeof(buf));
+
+    for (char *p = buf; len > 0 && p < buf + len; ) {
+        struct inotify_event *event = (struct inotify_event *)p;
+        if (event->len && strcmp(event->name, CONFIG_NAME) == 0) changed = 1;
+        p += sizeof(struct inotify_event) + event->len;
+    }
+    return changed;
+}
+
+int main(int argc, char *argv[]) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_IGN;
+    sa.sa_flags = SA_NOCLDWAIT;
+    sigaction(SIGCHLD, &sa, NULL);
+
+    ensure_config_exists();
+
+    display = XOpenDisplay(NULL);
+    if (!display) {
+        fprintf(stderr, "abind: cannot open display\n");
+        return 1;
+    }
+    root = DefaultRootWindow(display);
+    XSetErrorHandler(on_x_error);
+    XkbSetDetectableAutoRepeat(display, True, NULL);
+
+    int x_fd = ConnectionNumber(display);
+    fcntl(x_fd, F_SETFD, FD_CLOEXEC);
+
+    int inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (inotify_fd >= 0) {
+        inotify_add_watch(inotify_fd, config_dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+    }
+
+    load_config();
+
+    for (;;) {
+        while (XPending(display)) {
+            XEvent event;
+            XNextEvent(display, &event);
+            if (event.type == KeyPress) {
+                handle_key_press(&event.xkey);
+            } else if (event.type == KeyRelease) {
+                pressed_keycode = 0;
+            } else if (event.type == MappingNotify) {
+                XRefreshKeyboardMapping(&event.xmapping);
+                load_config();
+            }
+        }
+
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(x_fd, &fds);
+        if (inotify_fd >= 0) FD_SET(inotify_fd, &fds);
+
+        if (select((x_fd > inotify_fd ? x_fd : inotify_fd) + 1, &fds, NULL, NULL, NULL) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (inotify_fd >= 0 && FD_ISSET(inotify_fd, &fds) && config_changed(inotify_fd)) {
+            load_config();
+        }
+    }
+
+    XCloseDisplay(display);
+    return 0;
+}
@@ -0,0 +1,597 @@
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <glib-unix.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <signal.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#define CONFIG_FILE "/.config/alinuxd/session.ini"
+#define TIMING_FILE "alinuxd-session.json"
+#define READY_TIMEOUT 30
+#define READY_POLL_MS 50
+#define RESTART_MIN_MS 500
+#define RESTART_MAX_MS 30000
+#define RESTART_RESET_MS 30000
+#define STOP_TIMEOUT 5
+
+typedef enum {
+    READY_NONE,
+    READY_WM,
+    READY_SOCKET
+} ReadyKind;
+
+typedef struct {
+    char *name;
+    char **argv;
+    char **after;
+    ReadyKind ready;
+    char *socket_path;
+    gboolean restart;
+    gboolean session;
+    GPid pid;
+    gboolean is_ready;
+    gboolean waiting;
+    gint64 spawn_time;
+    gint64 first_spawn;
+    gint64 first_ready;
+    gint64 first_timeout;
+    guint restarts;
+    guint backoff_ms;
+    guint retry_id;
+    guint poll_id;
+    guint timeout_id;
+    Window wm_check_before;
+    GSocketConnection *probe;
+} Component;
+
+GMainLoop *loop;
+GPtrArray *components;
+gint64 session_start;
+gboolean stopping;
+guint stop_timer_id;
+Display *display;
+Window root;
+Atom net_supporting_wm_check;
+
+const char *default_config =
+    "# Components of the ALinuxD session, all started in parallel.\n"
+    "#   command  what to run\n"
+    "#   after    components that must be ready first\n"
+    "#   ready    none (default), wm (a window manager has taken over) or\n"
+    "#            socket:PATH (PATH, relative to $XDG_RUNTIME_DIR, answers a ping)\n"
+    "#   restart  restart it when it crashes (default true)\n"
+    "#   session  the session ends when it exits cleanly\n"
+    "\n"
+    "[openbox]\n"
+    "command=openbox --replace\n"
+    "ready=wm\n"
+    "session=true\n"
+    "\n"
+    "[abind]\n"
+    "command=abind\n"
+    "\n"
+    "[atermd]\n"
+    "command=atermd\n"
+    "after=openbox\n"
+    "ready=socket:atermd.sock\n"
+    "\n"
+    "[xautolock]\n"
+    "command=xautolock -time 100000000000 -locker \"xscreensaver-command -lock\"\n";
+
+void start_ready_components();
+void stop_session();
+gboolean all_stopped();
+gboolean on_stop_timeout(gpointer data);
+
+double elapsed_ms(gint64 since) {
+    return (g_get_monotonic_time() - since) / 1000.0;
+}
+
+Component *find_component(const char *name) {
+    for (guint i = 0; i < components->len; i++) {
+        Component *component = g_ptr_array_index(components, i);
+        if (strcmp(component->name, name) == 0) return component;
+    }
+    return NULL;
+}
+
+void write_timing() {
+    GString *json = g_string_new("{\"components\":[");
+    for (guint i = 0; i < components->len; i++) {
+        Component *component = g_ptr_array_index(components, i);
+        g_string_append_printf(json, "%s\n{\"name\":\"%s\",\"start_ms\":%.1f,\"ready_ms\":%.1f,"
+                               "\"timeout_ms\":%.1f,\"restarts\":%u}",
+                               i ? "," : "", component->name,
+                               component->first_spawn ? (component->first_spawn - session_start) / 1000.0 : -1,
+                               component->first_ready ? (component->first_ready - session_start) / 1000.0 : -1,
+                               component->first_timeout ? (component->first_timeout - session_start) / 1000.0 : -1,
+                               component->restarts);
+    }
+    g_string_append(json, "\n]}\n");
+
+    char *path = g_build_filename(g_get_user_runtime_dir(), TIMING_FILE, NULL);
+    g_file_set_contents(path, json->str, json->len, NULL);
+    g_free(path);
+    g_string_free(json, TRUE);
+}
+
+void stop_waiting(Component *component) {
+    component->waiting = FALSE;
+    if (component->poll_id) {
+        g_source_remove(component->poll_id);
+        component->poll_id = 0;
+    }
+    if (component->timeout_id) {
+        g_source_remove(component->timeout_id);
+        component->timeout_id = 0;
+    }
+    g_clear_object(&component->probe);
+}
+
+void mark_ready(Component *component, gboolean timed_out) {
+    if (component->is_ready) return;
+    stop_waiting(component);
+    component->is_ready = TRUE;
+
+    if (timed_out) {
+        /* Not a startup time; kept apart so ready_ms stays honest. */
+        if (!component->first_timeout) {
+            component->first_timeout = g_get_monotonic_time();
+        }
+        g_warning("%s is not ready after %d s; starting its dependents anyway", component->name, READY_TIMEOUT);
+    } else {
+        if (!component->first_ready) {
+            component->first_ready = g_get_monotonic_time();
+        }
+        g_message("%s ready in %.1f ms (%.1f ms into the session)", component->name,
+                  elapsed_ms(component->spawn_time), elapsed_ms(session_start));
+    }
+    write_timing();
+    start_ready_components();
+}
+
+Window get_wm_check() {
+    Atom type;
+    int format;
+    unsigned long count, remaining;
+    unsigned char *data = NULL;
+    Window window = None;
+
+    if (display && XGetWindowProperty(display, root, net_supporting_wm_check, 0, 1, False, XA_WINDOW,
+                                      &type, &format, &count, &remaining, &data) == Success) {
+        if (data && count == 1) {
+            window = *(Window *)data;
+        }
+    }
+    if (data) {
+        XFree(data);
+    }
+    return window;
+}
+
+void check_wm_ready() {
+    for (guint i = 0; i < components->len; i++) {
+        Component *component = g_ptr_array_index(components, i);
+        if (component->waiting && component->ready == READY_WM) {
+            Window window = get_wm_check();
+            if (window != None && window != component->wm_check_before) {
+                mark_ready(component, FALSE);
+            }
+        }
+    }
+}
+
+gboolean on_x_event(gint fd, GIOCondition condition, gpointer user_data) {
+    gboolean wm_changed = FALSE;
+
+    while (XPending(display)) {
+        XEvent event;
+        XNextEvent(display, &event);
+        if (event.type == PropertyNotify && event.xproperty.atom == net_supporting_wm_check) {
+            wm_changed = TRUE;
+        }
+    }
+    if (wm_changed) {
+        check_wm_ready();
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+int on_x_error(Display *dpy, XErrorEvent *event) {
+    return 0;
+}
+
+void wait_for_components() {
+    /* For when the main loop cannot run again: the same SIGTERM, grace
+       period and SIGKILL as stop_session(), but waited for in place. */
+    gint64 deadline = g_get_monotonic_time() + STOP_TIMEOUT * G_USEC_PER_SEC;
+    gboolean killed = FALSE;
+
+    while (!all_stopped()) {
+        if (!killed && g_get_monotonic_time() >= deadline) {
+            on_stop_timeout(NULL);
+            killed = TRUE;
+        }
+        for (guint i = 0; i < components->len; i++) {
+            Component *component = g_ptr_array_index(components, i);
+            if (component->pid > 0) {
+                pid_t reaped = waitpid(component->pid, NULL, killed ? 0 : WNOHANG);
+                if (reaped == component->pid || (reaped < 0 && errno != EINTR)) {
+                    component->pid = 0;
+                }
+            }
+        }
+        if (!killed) {
+            g_usleep(READY_POLL_MS * 1000);
+        }
+    }
+}
+
+int on_x_io_error(Display *dpy) {
+    /* The X server is gone, and with it the session. Xlib exits as soon
+       as this returns, so finish stopping the components here. */
+    stop_session();
+    wait_for_components();
+    exit(0);
+}
+
+gboolean on_probe_poll(gpointer data);
+
+void on_probe_reply(GObject *source, GAsyncResult *result, gpointer user_data) {
+    Component *component = user_data;
+    char *line = g_data_input_stream_read_line_finish(G_DATA_INPUT_STREAM(source), result, NULL, NULL);
+
+    g_object_unref(source);
+    if (!component->waiting || !component->probe) {
+        g_free(line);
+        return;
+    }
+    g_clear_object(&component->probe);
+    if (line) {
+        mark_ready(component, FALSE);
+    } else {
+        component->poll_id = g_timeout_add(READY_POLL_MS, on_probe_poll, component);
+    }
+    g_free(line);
+}
+
+void on_probe_connected(GObject *source, GAsyncResult *result, gpointer user_data) {
+    Component *component = user_data;
+    GSocketConnection *connection = g_socket_client_connect_finish(G_SOCKET_CLIENT(source), result, NULL);
+
+    g_object_unref(source);
+    if (!component->waiting) {
+        g_clear_object(&connection);
+        return;
+    }
+    if (!connection) {
+        component->poll_id = g_timeout_add(READY_POLL_MS, on_probe_poll, component);
+        return;
+    }
+
+    /* A reply means the component's main loop is running, not just that
+       it has bound the socket. */
+    component->probe = connection;
+    GOutputStream *output = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+    g_output_stream_write_all(output, "ping\n", 5, NULL, NULL, NULL);
+    GDataInputStream *input = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+    g_data_input_stream_read_line_async(input, G_PRIORITY_DEFAULT, NULL, on_probe_reply, component);
+}
+
+gboolean on_probe_poll(gpointer data) {
+    Component *component = data;
+    component->poll_id = 0;
+
+    GSocketClient *client = g_socket_client_new();
+    GSocketAddress *address = g_unix_socket_address_new(component->socket_path);
+    g_socket_client_connect_async(client, G_SOCKET_CONNECTABLE(address), NULL, on_probe_connected, component);
+    g_object_unref(address);
+    return G_SOURCE_REMOVE;
+}
+
+gboolean on_ready_timeout(gpointer data) {
+    Component *component = data;
+    component->timeout_id = 0;
+    mark_ready(component, TRUE);
+    return G_SOURCE_REMOVE;
+}
+
+void on_component_exited(GPid pid, gint status, gpointer user_data);
+
+void start_component(Component *component) {
+    GError *error = NULL;
+
+    component->spawn_time = g_get_monotonic_time();
+    if (!component->first_spawn) {
+        component->first_spawn = component->spawn_time;
+    }
+    component->wm_check_before = component->ready == READY_WM ? get_wm_check() : None;
+    if (!g_spawn_async(NULL, component->argv, NULL, G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                       NULL, NULL, &component->pid, &error)) {
+        /* Usually not installed; retrying will not help, and nothing
+           should wait for it. */
+        g_warning("Failed to start %s: %s", component->name, error->message);
+        g_error_free(error);
+        component->pid = 0;
+        component->is_ready = TRUE;
+        start_ready_components();
+        return;
+    }
+    g_child_watch_add(component->pid, on_component_exited, component);
+    g_message("started %s (pid %d) %.1f ms into the session", component->name, component->pid,
+              elapsed_ms(session_start));
+
+    if (component->is_ready) {
+        /* A restart; whatever depends on it is already running. */
+        return;
+    }
+    if (component->ready == READY_NONE || (component->ready == READY_WM && !display)) {
+        mark_ready(component, FALSE);
+        return;
+    }
+
+    component->waiting = TRUE;
+    component->timeout_id = g_timeout_add_seconds(READY_TIMEOUT, on_ready_timeout, component);
+    if (component->ready == READY_WM) {
+        check_wm_ready();
+    } else {
+        on_probe_poll(component);
+    }
+}
+
+gboolean dependencies_ready(Component *component) {
+    for (char **name = component->after; name && *name; name++) {
+        Component *dependency = find_component(*name);
+        if (dependency && !dependency->is_ready) return FALSE;
+    }
+    return TRUE;
+}
+
+void start_ready_components() {
+    if (stopping) return;
+
+    for (guint i = 0; i < components->len; i++) {
+        Component *component = g_ptr_array_index(components, i);
+        if (!component->first_spawn && dependencies_ready(component)) {
+            start_component(component);
+        }
+    }
+}
+
+gboolean on_restart(gpointer data) {
+    Component *component = data;
+    component->retry_id = 0;
+    component->restarts++;
+    start_component(component);
+    return G_SOURCE_REMOVE;
+}
+
+gboolean all_stopped() {
+    for (guint i = 0; i < components->len; i++) {
+        Component *component = g_ptr_array_index(components, i);
+        if (component->pid > 0) return FALSE;
+    }
+    return TRUE;
+}
+
+void on_component_exited(GPid pid, gint status, gpointer user_data) {
+    Component *component = user_data;
+    gboolean clean = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+    if (pid > 0) {
+        g_spawn_close_pid(pid);
+    }
+    component->pid = 0;
+    stop_waiting(component);
+
+    if (stopping) {
+        if (all_stopped()) {
+            g_main_loop_quit(loop);
+        }
+        return;
+    }
+    if (WIFSIGNALED(status)) {
+        g_warning("%s was killed by signal %d", component->name, WTERMSIG(status));
+    } else if (!clean) {
+        g_warning("%s exited with status %d", component->name, WEXITSTATUS(status));
+    }
+
+    if (component->session && clean) {
+        g_message("%s exited; ending the session", component->name);
+        stop_session();
+        return;
+    }
+    if (!component->restart || (clean && !component->session)) {
+        /* It is not coming back, so do not hold up its dependents. */
+        if (!component->is_ready) {
+            component->is_ready = TRUE;
+            start_ready_components();
+        }
+        return;
+    }
+
+    /* Back off while it keeps crashing soon after starting. */
+    if (component->spawn_time && elapsed_ms(component->spawn_time) > RESTART_RESET_MS) {
+        component->backoff_ms = RESTART_MIN_MS;
+    } else {
+        component->backoff_ms = CLAMP(component->backoff_ms * 2, RESTART_MIN_MS, RESTART_MAX_MS);
+    }
+    g_message("restarting %s in %u ms", component->name, component->backoff_ms);
+    component->retry_id = g_timeout_add(component->backoff_ms, on_restart, component);
+}
+
+gboolean on_stop_timeout(gpointer data) {
+    stop_timer_id = 0;
+    for (guint i = 0; i < components->len; i++) {
+        Component *component = g_ptr_array_index(components, i);
+        if (component->pid > 0) {
+            g_warning("%s did not stop; killing it", component->name);
+            kill(component->pid, SIGKILL);
+        }
+    }
+    return G_SOURCE_REMOVE;
+}
+
+void stop_session() {
+    if (stopping) return;
+    stopping = TRUE;
+
+    for (guint i = 0; i < components->len; i++) {
+        Component *component = g_ptr_array_index(components, i);
+        if (component->retry_id) {
+            g_source_remove(component->retry_id);
+            component->retry_id = 0;
+        }
+        stop_waiting(component);
+        if (component->pid > 0) {
+            kill(component->pid, SIGTERM);
+        }
+    }
+    if (all_stopped()) {
+        g_main_loop_quit(loop);
+    } else {
+        stop_timer_id = g_timeout_add_seconds(STOP_TIMEOUT, on_stop_timeout, NULL);
+    }
+}
+
+gboolean on_stop_signal(gpointer data) {
+    stop_session();
+    return G_SOURCE_CONTINUE;
+}
+
+void free_component(gpointer data) {
+    Component *component = data;
+    stop_waiting(component);
+    g_free(component->name);
+    g_strfreev(component->argv);
+    g_strfreev(component->after);
+    g_free(component->socket_path);
+    g_free(component);
+}
+
+gboolean parse_ready(Component *component, const char *ready) {
+    if (!ready || strcmp(ready, "none") == 0) {
+        component->ready = READY_NONE;
+    } else if (strcmp(ready, "wm") == 0) {
+        component->ready = READY_WM;
+    } else if (g_str_has_prefix(ready, "socket:") && ready[7]) {
+        component->ready = READY_SOCKET;
+        component->socket_path = g_path_is_absolute(ready + 7) ? g_strdup(ready + 7) :
+                                 g_build_filename(g_get_user_runtime_dir(), ready + 7, NULL);
+    } else {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+gboolean load_config() {
+    char *path = g_build_filename(g_get_home_dir(), CONFIG_FILE, NULL);
+    char *dir = g_path_get_dirname(path);
+    g_mkdir_with_parents(dir, 0755);
+    g_free(dir);
+    if (!g_file_test(path, G_FILE_TEST_EXISTS)) {
+        g_file_set_contents(path, default_config, -1, NULL);
+    }
+
+    GKeyFile *key_file = g_key_file_new();
+    GError *error = NULL;
+    if (!g_key_file_load_from_file(key_file, path, G_KEY_FILE_NONE, &error)) {
+        g_warning("Failed to read %s: %s; using the defaults", path, error->message);
+        g_clear_error(&error);
+        g_key_file_load_from_data(key_file, default_config, -1, G_KEY_FILE_NONE, NULL);
+    }
+    g_free(path);
+
+    components = g_ptr_array_new_with_free_func(free_component);
+    char **groups = g_key_file_get_groups(key_file, NULL);
+    for (char **group = groups; *group; group++) {
+        char *command = g_key_file_get_string(key_file, *group, "command", NULL);
+        char *ready = g_key_file_get_string(key_file, *group, "ready", NULL);
+        Component *component = g_new0(Component, 1);
+
+        component->name = g_strdup(*group);
+        component->after = g_key_file_get_string_list(key_file, *group, "after", NULL, NULL);
+        component->restart = !g_key_file_has_key(key_file, *group, "restart", NULL) ||
+                             g_key_file_get_boolean(key_file, *group, "restart", NULL);
+        component->session = g_key_file_get_boolean(key_file, *group, "session", NULL);
+        component->backoff_ms = RESTART_MIN_MS / 2;
+
+        if (!command || !g_shell_parse_argv(command, NULL, &component->argv, &error)) {
+            g_warning("Skipping [%s]: %s", *group, error ? error->message : "no command");
+            g_clear_error(&error);
+            free_component(component);
+        } else if (!parse_ready(component, ready)) {
+            g_warning("Skipping [%s]: unknown ready=%s", *group, ready);
+            free_component(component);
+        } else {
+            g_ptr_array_add(components, component);
+        }
+        g_free(command);
+        g_free(ready);
+    }
+    g_strfreev(groups);
+    g_key_file_free(key_file);
+
+    for (guint i = 0; i < components->len; i++) {
+        Component *component = g_ptr_array_index(components, i);
+        for (char **name = component->after; name && *name; name++) {
+            if (!find_component(*name)) {
+                g_warning("[%s] waits for unknown component %s; ignoring it", component->name, *name);
+            }
+        }
+    }
+    return components->len > 0;
+}
+
+void open_display() {
+    display = XOpenDisplay(NULL);
+    if (!display) {
+        g_warning("Cannot open display; not waiting for the window manager");
+        return;
+    }
+    root = DefaultRootWindow(display);
+    net_supporting_wm_check = XInternAtom(display, "_NET_SUPPORTING_WM_CHECK", False);
+    XSetErrorHandler(on_x_error);
+    XSetIOErrorHandler(on_x_io_error);
+    XSelectInput(display, root, PropertyChangeMask);
+    XFlush(display);
+    g_unix_fd_add(ConnectionNumber(display), G_IO_IN, on_x_event, NULL);
+}
+
+int main(int argc, char *argv[]) {
+    session_start = g_get_monotonic_time();
+    if (argc > 1) {
+        fprintf(stderr, "Usage: alinuxd-session\n\nComponents are read from ~%s\n", CONFIG_FILE);
+        return 1;
+    }
+
+    if (!load_config()) {
+        g_warning("Nothing to start");
+        return 1;
+    }
+    loop = g_main_loop_new(NULL, FALSE);
+    open_display();
+
+    g_unix_signal_add(SIGTERM, on_stop_signal, NULL);
+    g_unix_signal_add(SIGINT, on_stop_signal, NULL);
+    g_unix_signal_add(SIGHUP, on_stop_signal, NULL);
+
+    start_ready_components();
+    g_main_loop_run(loop);
+
+    if (stop_timer_id) {
+        g_source_remove(stop_timer_id);
+    }
+    g_ptr_array_free(components, TRUE);
+    if (display) {
+        XCloseDisplay(display);
+    }
+    g_main_loop_unref(loop);
+    return 0;
+}
@@ -0,0 +1,304 @@
+#include "amatch.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define AMATCH_FIELDS 3
+#define AMATCH_MAX_QUERY 256
+
+#define SCORE_EXACT 1000
+#define SCORE_PREFIX 900
+#define SCORE_WORD 800
+#define SCORE_ACRONYM 700
+#define SCORE_SUBSTRING 600
+#define SCORE_FUZZY 400
+
+static const int field_penalty[AMATCH_FIELDS] = { 0, 150, 250 };
+
+typedef struct {
+    char *text;
+    unsigned char *starts;
+    char *acronym;
+    size_t len;
+    size_t acronym_len;
+} AMatchField;
+
+struct AMatchItem {
+    void *data;
+    size_t index;
+    int boost;
+    uint64_t mask;
+    AMatchField fields[AMATCH_FIELDS];
+};
+
+typedef struct {
+    AMatchItem **items;
+    size_t len;
+    size_t cap;
+} ItemList;
+
+typedef struct {
+    AMatchItem *item;
+    int score;
+} Scored;
+
+struct AMatcher {
+    ItemList all;
+    ItemList levels[AMATCH_MAX_QUERY + 1];
+    char query[AMATCH_MAX_QUERY + 1];
+    size_t depth;
+    Scored *scored;
+    AMatchResult *results;
+    size_t results_cap;
+};
+
+static char fold(char c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static int is_word_char(char c) {
+    unsigned char u = (unsigned char)c;
+    return (u >= 'a' && u <= 'z') || (u >= 'A' && u <= 'Z') || (u >= '0' && u <= '9') || u >= 0x80;
+}
+
+static uint64_t char_bit(char c) {
+    return 1ULL << ((unsigned char)c & 63);
+}
+
+static void list_push(ItemList *list, AMatchItem *item) {
+    if (list->len == list->cap) {
+        list->cap = list->cap ? list->cap * 2 : 64;
+        list->items = realloc(list->items, list->cap * sizeof(*list->items));
+    }
+    list->items[list->len++] = item;
+}
+
+static void init_field(AMatchField *field, const char *src, uint64_t *mask) {
+    field->len = src ? strlen(src) : 0;
+    field->text = malloc(field->len + 1);
+    field->starts = malloc(field->len + 1);
+    field->acronym = malloc(field->len + 1);
+    field->acronym_len = 0;
+
+    for (size_t i = 0; i < field->len; i++) {
+        char c = src[i];
+        char prev = i > 0 ? src[i - 1] : ' ';
+        int start = is_word_char(c) &&
+                    (!is_word_char(prev) || (prev >= 'a' && prev <= 'z' && c >= 'A' && c <= 'Z'));
+
+        field->text[i] = fold(c);
+        field->starts[i] = start;
+        if (start) {
+            field->acronym[field->acronym_len++] = fold(c);
+        }
+        *mask |= char_bit(field->text[i]);
+    }
+    field->text[field->len] = '\0';
+    field->acronym[field->acronym_len] = '\0';
+}
+
+static int field_has_subsequence(const AMatchField *field, const char *query, size_t n) {
+    size_t j = 0;
+    for (size_t i = 0; i < field->len && j < n; i++) {
+        if (field->text[i] == query[j]) j++;
+    }
+    return j == n;
+}
+
+static int item_matches(const AMatchItem *item, const char *query, size_t n) {
+    for (int f = 0; f < AMATCH_FIELDS; f++) {
+        if (field_has_subsequence(&item->fields[f], query, n)) return 1;
+    }
+    return 0;
+}
+
+static int clamp_offset(size_t offset) {
+    return offset > 50 ? 50 : (int)offset;
+}
+
+static int score_field(const AMatchField *field, const char *query, size_t n) {
+    if (n > field->len) return -1;
+
+    if (memcmp(field->text, query, n) == 0) {
+        return n == field->len ? SCORE_EXACT : SCORE_PREFIX;
+    }
+
+    for (size_t i = 1; i + n <= field->len; i++) {
+        if (field->starts[i] && memcmp(field->text + i, query, n) == 0) {
+            return SCORE_WORD - clamp_offset(i);
+        }
+    }
+
+    if (n <= field->acronym_len && n > 1 && memcmp(field->acronym, query, n) == 0) {
+        return SCORE_ACRONYM;
+    }
+
+    for (size_t i = 1; i + n <= field->len; i++) {
+        if (memcmp(field->text + i, query, n) == 0) {
+            return SCORE_SUBSTRING - clamp_offset(i);
+        }
+    }
+
+    size_t j = 0, first = 0, last = 0;
+    int bonus = 0;
+    for (size_t i = 0; i < field->len && j < n; i++) {
+        if (field->text[i] != query[j]) continue;
+        if (j == 0) first = i;
+        if (field->starts[i]) bonus += 10;
+        last = i;
+        j++;
+    }
+    if (j < n) return -1;
+
+    int score = SCORE_FUZZY + bonus - 2 * (int)(last - first + 1 - n) - clamp_offset(first);
+    if (score < 1) score = 1;
+    if (score > SCORE_SUBSTRING - 101) score = SCORE_SUBSTRING - 101;
+    return score;
+}
+
+static int score_item(const AMatchItem *item, const char *query, size_t n) {
+    int best = INT_MIN;
+    for (int f = 0; f < AMATCH_FIELDS; f++) {
+        int score = score_field(&item->fields[f], query, n);
+        if (score < 0) continue;
+        score -= field_penalty[f];
+        if (score > best) best = score;
+    }
+    return best == INT_MIN ? best : best + item->boost;
+}
+
+static int compare_scored(const void *a, const void *b) {
+    const Scored *x = a;
+    const Scored *y = b;
+    if (x->score != y->score) return y->score - x->score;
+
+    const AMatchField *xn = &x->item->fields[0];
+    const AMatchField *yn = &y->item->fields[0];
+    if (xn->len != yn->len) return xn->len < yn->len ? -1 : 1;
+    return strcmp(xn->text, yn->text);
+}
+
+AMatcher *amatch_new(void) {
+    return calloc(1, sizeof(AMatcher));
+}
+
+static void free_item(AMatchItem *item) {
+    for (int f = 0; f < AMATCH_FIELDS; f++) {
+        free(item->fields[f].text);
+        free(item->fields[f].starts);
+        free(item->fields[f].acronym);
+    }
+    free(item);
+}
+
+void amatch_free(AMatcher *matcher) {
+    if (!matcher) return;
+
+    for (size_t i = 0; i < matcher->all.len; i++) {
+        free_item(matcher->all.items[i]);
+    }
+    free(matcher->all.items);
+    for (size_t k = 0; k <= AMATCH_MAX_QUERY; k++) {
+        free(matcher->levels[k].items);
+    }
+    free(matcher->scored);
+    free(matcher->results);
+    free(matcher);
+}
+
+AMatchItem *amatch_add(AMatcher *matcher, void *data, const char *name,
+                       const char *generic_name, const char *keywords) {
+    AMatchItem *item = calloc(1, sizeof(AMatchItem));
+    item->data = data;
+    init_field(&item->fields[0], name, &item->mask);
+    init_field(&item->fields[1], generic_name, &item->mask);
+    init_field(&item->fields[2], keywords, &item->mask);
+
+    item->index = matcher->all.len;
+    list_push(&matcher->all, item);
+    matcher->depth = 0;
+    return item;
+}
+
+void amatch_remove(AMatcher *matcher, AMatchItem *item) {
+    AMatchItem *moved = matcher->all.items[--matcher->all.len];
+    matcher->all.items[item->index] = moved;
+    moved->index = item->index;
+
+    free_item(item);
+    matcher->depth = 0;
+}
+
+void amatch_set_boost(AMatchItem *item, int boost) {
+    item->boost = boost;
+}
+
+size_t amatch_count(const AMatcher *matcher) {
+    return matcher->all.len;
+}
+
+const AMatchResult *amatch_query(AMatcher *matcher, const char *query, size_t *n_results) {
+    char q[AMATCH_MAX_QUERY + 1];
+    size_t n = 0;
+
+    while (query[n] && n < AMATCH_MAX_QUERY) {
+        q[n] = fold(query[n]);
+        n++;
+    }
+    q[n] = '\0';
+    *n_results = 0;
+    if (n == 0) return matcher->results;
+
+    /* Each level holds the items matching one more character of the
+       query, so typing narrows the previous level and backspace is free. */
+    size_t common = 0;
+    while (common < matcher->depth && common < n && matcher->query[common] == q[common]) {
+        common++;
+    }
+
+    uint64_t mask = 0;
+    for (size_t k = 0; k < common; k++) {
+        mask |= char_bit(q[k]);
+    }
+    for (size_t k = common + 1; k <= n; k++) {
+        const ItemList *prev = k == 1 ? &matcher->all : &matcher->levels[k - 1];
+        ItemList *next = &matcher->levels[k];
+
+        mask |= char_bit(q[k - 1]);
+        next->len = 0;
+        for (size_t i = 0; i < prev->len; i++) {
+            AMatchItem *item = prev->items[i];
+            if ((item->mask & mask) == mask && item_matches(item, q, k)) {
+                list_push(next, item);
+            }
+        }
+    }
+    memcpy(matcher->query, q, n + 1);
+    matcher->depth = n;
+
+    const ItemList *matches = &matcher->levels[n];
+    if (matches->len > matcher->results_cap) {
+        matcher->results_cap = matches->cap;
+        matcher->scored = realloc(matcher->scored, matcher->results_cap * sizeof(Scored));
+        matcher->results = realloc(matcher->results, matcher->results_cap * sizeof(AMatchResult));
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < matches->len; i++) {
+        int score = score_item(matches->items[i], q, n);
+        if (score == INT_MIN) continue;
+        matcher->scored[count].item = matches->items[i];
+        matcher->scored[count].score = score;
+        count++;
+    }
+    qsort(matcher->scored, count, sizeof(Scored), compare_scored);
+
+    for (size_t i = 0; i < count; i++) {
+        matcher->results[i].data = matcher->scored[i].item->data;
+        matcher->results[i].score = matcher->scored[i].score;
+    }
+    *n_results = count;
+    return matcher->results;
+}
@@ -0,0 +1,36 @@
+#ifndef AMATCH_H
+#define AMATCH_H
+
+#include <stddef.h>
+
+/*
+ * Ranked fuzzy matcher used by AmenuD.
+ *
+ * Fields are lowercased (ASCII) and split into word starts once, when an
+ * item is added. Queries are matched case-insensitively against the name,
+ * generic name and keywords; a query that extends the previous one only
+ * rescans the items that matched its prefix.
+ */
+
+typedef struct AMatcher AMatcher;
+typedef struct AMatchItem AMatchItem;
+
+typedef struct {
+    void *data;
+    int score;
+} AMatchResult;
+
+AMatcher *amatch_new(void);
+void amatch_free(AMatcher *matcher);
+
+AMatchItem *amatch_add(AMatcher *matcher, void *data, const char *name,
+                       const char *generic_name, const char *keywords);
+void amatch_remove(AMatcher *matcher, AMatchItem *item);
+/* Added to the item's score on every match, e.g. from launch history. */
+void amatch_set_boost(AMatchItem *item, int boost);
+size_t amatch_count(const AMatcher *matcher);
+
+/* Results are sorted best first and stay valid until the next call. */
+const AMatchResult *amatch_query(AMatcher *matcher, const char *query, size_t *n_results);
+
+#endif
@@ -1,34 +1,417 @@
+#define _GNU_SOURCE
 #include <gtk/gtk.h>
 #include <vte/vte.h>
 #include <gdk/gdkx.h>
 #include <X11/Xlib.h>
 #include <time.h>
-#include <dirent.h>
+#include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <utime.h>
+#include <spawn.h>
+#include <stdatomic.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <glib/gstdio.h>
 #include <glib/gkeyfile.h>
+#include "amatch.h"
 
 #define TAB_COUNT 10
+#define PREWARM_DELAY 10
+#define SCROLLBACK_LINES 10000
+#define SCROLLBACK_BUDGET_MB 64
+#define SCROLLBACK_MIN_LINES 500
+#define SCROLLBACK_CELL_BYTES 16
+#define SPILL_DIR "alinuxd/scrollback"
+#define SPILL_BATCH_ROWS 256
 #define CONFIG_FILE "/.config/alinuxd/conf.ini"
+#define CONFIG_SAVE_DELAY 500
 #define FONT_SIZE_STEP 1
 #define MIN_FONT_SIZE 8
 #define MAX_FONT_SIZE 32
+#define AMENU_PAGE_ROWS 10
+#define APPS_MENU_FREQUENT 8
+#define HISTORY_FILE "/.config/alinuxd/history"
+#define HISTORY_HALF_LIFE (14 * 24 * 3600.0)
+#define HISTORY_MAX_ENTRIES 256
+#define HISTORY_MIN_SCORE 0.01
+#define HISTORY_SAVE_DELAY 5
+#define POOL_SIZE 2
+#define POOL_MAX_SIZE 8
+#define POOL_MIN_AVAILABLE_MB 256
+#define POOL_CHECK_INTERVAL 30
+#define POOL_MAX_FAILURES 3
+#define STATUS_MODULES "cpu;mem;load;clock"
+#define STATUS_TICK_SLACK_MS 5
+#define STATUS_TEXT_SIZE 64
+#define ICON_MENU_SIZE 16
+#define ICON_AMENU_SIZE 24
+#define ICON_CACHE_SIZE 256
+#define ICON_LOADER_THREADS 2
+#define ICON_CACHE_DIR "alinuxd/icons"
+#define ICON_DISK_CACHE_FILES 2048
+#define ICON_DISK_CACHE_DAYS 30
+#define CONTROL_SOCKET "atermd.sock"
+#define CONTROL_LOCK "atermd.lock"
+#define CONTROL_TIMEOUT 2
+#define TRACE_FILE "atermd-trace.json"
+#define TRACE_MAX_EVENTS 65536
+#define PASTE_CHUNK_SIZE 4096
+#define PASTE_CHUNKED_MIN (64 * 1024)
+#define SAVE_CHUNK_ROWS 1000
+#define RECORD_DIR "alinuxd/recordings"
+#define RECORD_RING_SIZE (4 * 1024 * 1024)
+#define RECORD_FLUSH_MS 250
+#define RECORD_ROTATE_MB 64
 
 gboolean on_key_press(GtkWidget *widget, GdkEventKey *event, gpointer user_data);
+GtkWidget *current_terminal();
+void update_tab_info();
+void update_transfer_progress();
+void config_set_integer(const char *group, const char *key, int value);
+void update_apps_menu_entry(const char *id);
+void run_in_new_tab(char **argv, const char *workdir, const char *launch_id);
+void on_closed_child_reaped(GPid pid, gint status, gpointer user_data);
+
+extern char **environ;
+
+typedef enum {
+    TRANSFER_PASTE,
+    TRANSFER_SAVE
+} TransferKind;
+
+typedef struct {
+    TransferKind kind;
+    GtkWidget *terminal;
+    guint source_id;
+    char *text;
+    gsize length;
+    gsize offset;
+    char *path;
+    glong first_row;
+    glong row;
+    glong end_row;
+} Transfer;
+
+typedef struct {
+    GtkWidget *page;
+    GtkWidget *terminal;
+    GPid pid;
+    int font_size;
+    char **argv;
+    char *workdir;
+    char *launch_id;
+    gint64 last_viewed;
+    glong scrollback_lines;
+    char *spill_path;
+    glong spilled_row;
+    gulong activity_handler;
+    gboolean activity_watched;
+    gboolean foreground;
+    gboolean activity;
+    gboolean bell;
+    Transfer *transfer;
+    guint recording;
+    gulong record_output_handler;
+    gulong record_input_handler;
+    glong record_row;
+    glong record_col;
+    gsize record_dropped;
+} Tab;
 
 GtkWidget *window;
 GtkWidget *notebook;
-GtkWidget *clock_label;
+GtkWidget *status_box;
 GtkWidget *header_bar;
 GtkWidget *tab_info_label;
-GtkWidget *terminal_tabs[TAB_COUNT];
+GtkWidget *transfer_box;
+GtkWidget *transfer_progress;
+GPtrArray *tabs;
 GtkWidget *about_dialog;
 GtkWidget *help_dialog;
 GtkWidget *amenu_window;
 GtkWidget *amenu_entry;
-GtkWidget *amenu_list;
+GtkWidget *amenu_view;
+GtkListStore *amenu_store;
 GtkClipboard *clipboard;
 GKeyFile *config;
+char *config_path;
+char *config_saved_data;
+guint config_save_id;
+GFileMonitor *config_monitor;
 int current_font_size = 16;
+int terminal_font_size;
+PangoFontDescription *terminal_font;
+
+char *shell_command;
+
+int scrollback_lines = SCROLLBACK_LINES;
+int scrollback_budget_mb = SCROLLBACK_BUDGET_MB;
+gboolean scrollback_spill;
+guint spill_serial;
+
+int *prewarm_tabs;
+gsize prewarm_count;
+gsize prewarm_next;
+
+typedef struct {
+    VtePty *pty;
+    GPid pid;
+    char *shell;
+    guint watch_id;
+} PooledShell;
+
+GQueue shell_pool = G_QUEUE_INIT;
+int pool_size = POOL_SIZE;
+int pool_min_available_mb = POOL_MIN_AVAILABLE_MB;
+gboolean pool_spawning;
+guint pool_refill_id;
+guint pool_failures;
+#if GLIB_CHECK_VERSION(2, 78, 0)
+GMemoryMonitor *memory_monitor;
+#else
+guint pool_check_id;
+#endif
+
+typedef struct {
+    char *id;
+    char *path;
+    char *name;
+    char *generic_name;
+    char *exec;
+    char *icon;
+    char **keywords;
+    char **categories;
+    char *workdir;
+    gboolean terminal;
+    gboolean no_display;
+    gboolean hidden;
+    AMatchItem *match_item;
+} DesktopApp;
+
+GPtrArray *app_dirs;
+GHashTable *app_index;
+AMatcher *app_matcher;
+GList *app_monitors;
+
+typedef struct {
+    double score;
+    gint64 last_used;
+} LaunchRecord;
+
+typedef enum {
+    FILE_WRITE_REPLACE,
+    FILE_WRITE_APPEND,
+    FILE_WRITE_APPEND_GZIP,
+    FILE_WRITE_DELETE
+} FileWriteMode;
+
+typedef struct {
+    FileWriteMode mode;
+    char *path;
+    char *contents;
+    gsize length;
+} FileWrite;
+
+typedef struct {
+    const char *category;
+    const char *label;
+} AppCategory;
+
+const AppCategory app_categories[] = {
+    { "AudioVideo", "Multimedia" },
+    { "Audio", "Multimedia" },
+    { "Video", "Multimedia" },
+    { "Development", "Development" },
+    { "Education", "Education" },
+    { "Science", "Education" },
+    { "Game", "Games" },
+    { "Graphics", "Graphics" },
+    { "Network", "Internet" },
+    { "Office", "Office" },
+    { "Settings", "Settings" },
+    { "System", "System" },
+    { "Utility", "Accessories" }
+};
+
+const char *app_menu_groups[] = {
+    "Accessories", "Development", "Education", "Games", "Graphics", "Internet",
+    "Multimedia", "Office", "Settings", "System", "Other"
+};
+
+#define APP_MENU_GROUPS G_N_ELEMENTS(app_menu_groups)
+
+GtkWidget *context_menu;
+GtkWidget *record_item;
+GtkWidget *apps_menu;
+GtkWidget *apps_menu_separator;
+GtkWidget *group_items[APP_MENU_GROUPS];
+GHashTable *apps_menu_items;
+GList *frequent_items;
+guint apps_menu_history_serial;
+
+GHashTable *launch_history;
+guint history_save_id;
+guint history_serial;
+
+typedef struct {
+    guint count;
+    gint64 total_us;
+    gint64 max_us;
+} LaunchStats;
+
+GHashTable *exec_path_cache;
+char *exec_path_env;
+LaunchStats launch_stats;
+GThreadPool *file_writer;
+
+typedef struct {
+    char *key;
+    GdkPixbuf *pixbuf;
+} IconEntry;
+
+typedef struct {
+    char *key;
+    char *path;
+    int size;
+    GdkPixbuf *pixbuf;
+} IconJob;
+
+GThreadPool *icon_loader;
+GHashTable *icon_cache;
+GQueue icon_lru = G_QUEUE_INIT;
+GHashTable *icon_waiters;
+char *icon_cache_dir;
+
+typedef enum {
+    RECORD_START,
+    RECORD_OUTPUT,
+    RECORD_INPUT,
+    RECORD_MARKER,
+    RECORD_STOP
+} RecordKind;
+
+typedef struct {
+    guint id;
+    RecordKind kind;
+    gint64 time;
+    gsize length;
+} RecordHeader;
+
+typedef struct {
+    RecordHeader header;
+    gsize pos;
+    char *data;
+} RecordControl;
+
+typedef struct {
+    char *base;
+    gboolean compress;
+    gint64 rotate_bytes;
+    int width;
+    int height;
+    int part;
+    gint64 part_start;
+    GFileOutputStream *out;
+    GOutputStream *stream;
+    GString *pending;
+} RecordFile;
+
+/* Single producer (the main thread), single consumer (the writer). */
+char *record_ring;
+atomic_size_t record_head;
+atomic_size_t record_tail;
+GThread *record_thread;
+GMutex record_lock;
+GCond record_wake;
+/* Starts and stops must never be dropped with a full ring, so they go
+   through this queue instead, under record_lock. */
+GQueue record_controls = G_QUEUE_INIT;
+gboolean record_stopping;
+guint record_serial;
+gboolean record_all;
+char *record_dir;
+gboolean record_compress = TRUE;
+int record_rotate_mb = RECORD_ROTATE_MB;
+
+enum {
+    AMENU_COL_ID,
+    AMENU_COL_NAME,
+    AMENU_N_COLS
+};
+
+enum {
+    SAMPLE_STAT,
+    SAMPLE_MEMINFO,
+    SAMPLE_LOADAVG,
+    SAMPLE_NETDEV,
+    SAMPLE_BATTERY_CAPACITY,
+    SAMPLE_BATTERY_STATUS,
+    SAMPLE_SOURCES
+};
+
+typedef struct {
+    int fds[SAMPLE_SOURCES];
+    char *battery_dir;
+    guint64 cpu_busy, cpu_total;
+    guint64 prev_cpu_busy, prev_cpu_total;
+    guint64 mem_total_kb, mem_available_kb;
+    double load;
+    guint64 net_rx, net_tx;
+    guint64 prev_net_rx, prev_net_tx;
+    gint64 net_time, prev_net_time;
+    int battery_capacity;
+    gboolean battery_charging;
+} StatusSampler;
+
+typedef struct {
+    const char *name;
+    guint interval;
+    guint sources;
+    gboolean (*format)(char *text, gsize size);
+} StatusModuleType;
+
+typedef struct {
+    const StatusModuleType *type;
+    GtkWidget *label;
+    char text[STATUS_TEXT_SIZE];
+} StatusModule;
+
+StatusSampler sampler = { { -1, -1, -1, -1, -1, -1 } };
+GPtrArray *status_modules;
+char *status_modules_setting;
+guint status_timer_id;
+gboolean status_paused = TRUE;
+
+typedef struct {
+    const char *name;
+    gint64 start_us;
+    gint64 duration_us;
+} TraceEvent;
+
+/* Startup spans are always buffered; once the first frame is drawn they
+   are kept only if tracing was asked for, and later spans are recorded
+   only while it stays enabled. */
+gboolean trace_enabled = TRUE;
+gboolean trace_startup_done;
+gint64 trace_origin;
+GArray *trace_events;
+guint trace_dropped;
+const char *trace_frame_name;
+gint64 trace_frame_start;
+char *trace_path;
+
+typedef struct {
+    GSocketConnection *connection;
+    GDataInputStream *input;
+    char *reply;
+} ControlClient;
+
+GSocketService *control_service;
+char *control_socket_path;
+gboolean bench_commands;
 
 typedef struct {
     GdkRGBA background;
@@ -44,17 +427,383 @@ const ColorScheme retro_terminal = {
     {0.0, 1.0, 0.0, 1.0}
 };
 
-void update_clock() {
+gint64 trace_begin() {
+    return trace_enabled ? g_get_monotonic_time() : 0;
+}
+
+void trace_end(const char *name, gint64 start) {
+    if (!trace_enabled || !start) return;
+    
+    if (!trace_events) {
+        trace_events = g_array_new(FALSE, FALSE, sizeof(TraceEvent));
+    }
+    if (trace_events->len >= TRACE_MAX_EVENTS) {
+        trace_dropped++;
+        return;
+    }
+    TraceEvent event = { name, start, g_get_monotonic_time() - start };
+    g_array_append_val(trace_events, event);
+}
+
+void trace_dump() {
+    if (!trace_path || !trace_events) return;
+    
+    GString *json = g_string_new("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    int pid = getpid();
+    g_string_append_printf(json, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":1,"
+                           "\"args\":{\"name\":\"atermd\"}}", pid);
+    for (guint i = 0; i < trace_events->len; i++) {
+        TraceEvent *event = &g_array_index(trace_events, TraceEvent, i);
+        g_string_append_printf(json, ",\n{\"name\":\"%s\",\"cat\":\"atermd\",\"ph\":\"X\","
+                               "\"ts\":%" G_GINT64_FORMAT ",\"dur\":%" G_GINT64_FORMAT ","
+                               "\"pid\":%d,\"tid\":1}",
+                               event->name, event->start_us - trace_origin, event->duration_us, pid);
+    }
+    g_string_append_printf(json, "\n],\"otherData\":{\"dropped\":%u}}\n", trace_dropped);
+    
+    GError *error = NULL;
+    if (!g_file_set_contents(trace_path, json->str, json->len, &error)) {
+        g_warning("Failed to write trace: %s", error->message);
+        g_error_free(error);
+    }
+    g_string_free(json, TRUE);
+}
+
+gboolean on_first_draw(GtkWidget *widget, cairo_t *cr, gpointer user_data) {
+    g_signal_handlers_disconnect_by_func(widget, on_first_draw, user_data);
+    trace_end("first-frame", trace_origin);
+    
+    trace_startup_done = TRUE;
+    trace_enabled = trace_path != NULL;
+    if (trace_enabled) {
+        trace_dump();
+    } else if (trace_events) {
+        g_array_free(trace_events, TRUE);
+        trace_events = NULL;
+    }
+    return FALSE;
+}
+
+gboolean on_trace_frame(GtkWidget *widget, cairo_t *cr, gpointer user_data) {
+    g_signal_handlers_disconnect_by_func(widget, on_trace_frame, user_data);
+    trace_end(trace_frame_name, trace_frame_start);
+    trace_frame_start = 0;
+    return FALSE;
+}
+
+void trace_until_frame(const char *name, gint64 start) {
+    /* Records a span that ends when the window next finishes drawing, for
+       work like font changes that is only paid for at paint time. */
+    if (!start || trace_frame_start) return;
+    
+    trace_frame_name = name;
+    trace_frame_start = start;
+    g_signal_connect_after(window, "draw", G_CALLBACK(on_trace_frame), NULL);
+}
+
+const char *sample_paths[SAMPLE_SOURCES] = {
+    "/proc/stat", "/proc/meminfo", "/proc/loadavg", "/proc/net/dev", "capacity", "status"
+};
+
+char *find_battery_dir() {
+    const char *root = "/sys/class/power_supply";
+    GDir *dir = g_dir_open(root, 0, NULL);
+    const char *name;
+    char *found = NULL;
+    
+    while (dir && !found && (name = g_dir_read_name(dir))) {
+        char *type_path = g_build_filename(root, name, "type", NULL);
+        char *type;
+        if (g_file_get_contents(type_path, &type, NULL, NULL)) {
+            if (g_str_has_prefix(type, "Battery")) {
+                found = g_build_filename(root, name, NULL);
+            }
+            g_free(type);
+        }
+        g_free(type_path);
+    }
+    if (dir) {
+        g_dir_close(dir);
+    }
+    return found;
+}
+
+gssize read_sample(int source, char *buf, gsize size) {
+    /* The files stay open between ticks; pread at offset 0 makes the
+       kernel regenerate them without an open/close per sample. */
+    if (sampler.fds[source] < 0) {
+        const char *path = sample_paths[source];
+        char *battery_path = NULL;
+        if (source >= SAMPLE_BATTERY_CAPACITY) {
+            if (!sampler.battery_dir) return -1;
+            path = battery_path = g_build_filename(sampler.battery_dir, path, NULL);
+        }
+        sampler.fds[source] = open(path, O_RDONLY | O_CLOEXEC);
+        g_free(battery_path);
+        if (sampler.fds[source] < 0) return -1;
+    }
+    
+    gssize len = pread(sampler.fds[source], buf, size - 1, 0);
+    if (len < 0) {
+        close(sampler.fds[source]);
+        sampler.fds[source] = -1;
+        return -1;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+guint64 meminfo_value(const char *data, const char *key) {
+    const char *line = strstr(data, key);
+    return line ? g_ascii_strtoull(line + strlen(key), NULL, 10) : 0;
+}
+
+void sample_status(guint sources) {
+    static char buf[16384];
+    
+    if ((sources & (1 << SAMPLE_STAT)) && read_sample(SAMPLE_STAT, buf, 512) > 0) {
+        guint64 v[8] = { 0 };
+        sscanf(buf, "cpu %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT
+               " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT
+               " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT,
+               &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]);
+        sampler.prev_cpu_busy = sampler.cpu_busy;
+        sampler.prev_cpu_total = sampler.cpu_total;
+        sampler.cpu_total = v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6] + v[7];
+        sampler.cpu_busy = sampler.cpu_total - v[3] - v[4];
+    }
+    if ((sources & (1 << SAMPLE_MEMINFO)) && read_sample(SAMPLE_MEMINFO, buf, 1024) > 0) {
+        sampler.mem_total_kb = meminfo_value(buf, "MemTotal:");
+        sampler.mem_available_kb = meminfo_value(buf, "MemAvailable:");
+    }
+    if ((sources & (1 << SAMPLE_LOADAVG)) && read_sample(SAMPLE_LOADAVG, buf, 128) > 0) {
+        sampler.load = g_ascii_strtod(buf, NULL);
+    }
+    if ((sources & (1 << SAMPLE_NETDEV)) && read_sample(SAMPLE_NETDEV, buf, sizeof(buf)) > 0) {
+        guint64 rx = 0, tx = 0;
+        char *save;
+        for (char *line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+            char *colon = strchr(line, ':');
+            if (!colon) continue;
+            
+            while (*line == ' ') line++;
+            if (strncmp(line, "lo:", 3) == 0) continue;
+            
+            guint64 if_rx = 0, if_tx = 0;
+            sscanf(colon + 1, "%" G_GUINT64_FORMAT " %*s %*s %*s %*s %*s %*s %*s %" G_GUINT64_FORMAT,
+                   &if_rx, &if_tx);
+            rx += if_rx;
+            tx += if_tx;
+        }
+        sampler.prev_net_rx = sampler.net_rx;
+        sampler.prev_net_tx = sampler.net_tx;
+        sampler.prev_net_time = sampler.net_time;
+        sampler.net_rx = rx;
+        sampler.net_tx = tx;
+        sampler.net_time = g_get_monotonic_time();
+    }
+    if (sources & (1 << SAMPLE_BATTERY_CAPACITY)) {
+        sampler.battery_capacity = read_sample(SAMPLE_BATTERY_CAPACITY, buf, 16) > 0 ? atoi(buf) : -1;
+        sampler.battery_charging = read_sample(SAMPLE_BATTERY_STATUS, buf, 32) > 0 &&
+                                   g_str_has_prefix(buf, "Charging");
+    }
+}
+
+void format_size(char *text, gsize size, double bytes) {
+    const char *units = "BKMGT";
+    while (bytes >= 1000 && units[1]) {
+        bytes /= 1024;
+        units++;
+    }
+    snprintf(text, size, bytes < 10 && *units != 'B' ? "%.1f%c" : "%.0f%c", bytes, *units);
+}
+
+gboolean format_clock(char *text, gsize size) {
     time_t now = time(NULL);
-    struct tm *t = localtime(&now);
-    char time_str[64];
-    strftime(time_str, sizeof(time_str), "%H:%M:%S | %a %d %b %Y", t);
-    gtk_label_set_text(GTK_LABEL(clock_label), time_str);
+    struct tm t;
+    localtime_r(&now, &t);
+    strftime(text, size, "%H:%M:%S | %a %d %b %Y", &t);
+    return TRUE;
 }
 
-gboolean on_clock_tick(gpointer data) {
-    update_clock();
-    return G_SOURCE_CONTINUE;
+gboolean format_cpu(char *text, gsize size) {
+    guint64 total = sampler.cpu_total - sampler.prev_cpu_total;
+    if (!sampler.prev_cpu_total || !total) {
+        snprintf(text, size, "CPU --%%");
+    } else {
+        snprintf(text, size, "CPU %2d%%", (int)((sampler.cpu_busy - sampler.prev_cpu_busy) * 100 / total));
+    }
+    return TRUE;
+}
+
+gboolean format_mem(char *text, gsize size) {
+    char used[16], total[16];
+    if (!sampler.mem_total_kb) return FALSE;
+    format_size(used, sizeof(used), (sampler.mem_total_kb - sampler.mem_available_kb) * 1024.0);
+    format_size(total, sizeof(total), sampler.mem_total_kb * 1024.0);
+    snprintf(text, size, "MEM %s/%s", used, total);
+    return TRUE;
+}
+
+gboolean format_load(char *text, gsize size) {
+    snprintf(text, size, "LOAD %.2f", sampler.load);
+    return TRUE;
+}
+
+gboolean format_net(char *text, gsize size) {
+    char rx[16], tx[16];
+    double seconds = (sampler.net_time - sampler.prev_net_time) / (double)G_USEC_PER_SEC;
+    if (!sampler.prev_net_time || seconds <= 0) {
+        snprintf(text, size, "NET --");
+        return TRUE;
+    }
+    format_size(rx, sizeof(rx), (sampler.net_rx - sampler.prev_net_rx) / seconds);
+    format_size(tx, sizeof(tx), (sampler.net_tx - sampler.prev_net_tx) / seconds);
+    snprintf(text, size, "NET \u2193%s \u2191%s", rx, tx);
+    return TRUE;
+}
+
+gboolean format_battery(char *text, gsize size) {
+    if (sampler.battery_capacity < 0) return FALSE;
+    snprintf(text, size, "BAT %d%%%s", sampler.battery_capacity, sampler.battery_charging ? "+" : "");
+    return TRUE;
+}
+
+const StatusModuleType status_module_types[] = {
+    { "clock", 1, 0, format_clock },
+    { "cpu", 2, 1 << SAMPLE_STAT, format_cpu },
+    { "mem", 5, 1 << SAMPLE_MEMINFO, format_mem },
+    { "load", 5, 1 << SAMPLE_LOADAVG, format_load },
+    { "net", 2, 1 << SAMPLE_NETDEV, format_net },
+    { "battery", 30, 1 << SAMPLE_BATTERY_CAPACITY, format_battery }
+};
+
+void update_status_modules(gboolean force) {
+    gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+    guint sources = 0;
+    
+    for (guint i = 0; i < status_modules->len; i++) {
+        StatusModule *module = g_ptr_array_index(status_modules, i);
+        if (force || now % module->type->interval == 0) {
+            sources |= module->type->sources;
+        }
+    }
+    sample_status(sources);
+    
+    for (guint i = 0; i < status_modules->len; i++) {
+        StatusModule *module = g_ptr_array_index(status_modules, i);
+        char text[STATUS_TEXT_SIZE] = "";
+        
+        if (!force && now % module->type->interval != 0) continue;
+        if (!module->type->format(text, sizeof(text))) {
+            text[0] = '\0';
+        }
+        if (strcmp(text, module->text) != 0) {
+            memcpy(module->text, text, sizeof(text));
+            gtk_label_set_text(GTK_LABEL(module->label), text);
+            gtk_widget_set_visible(module->label, text[0] != '\0');
+        }
+    }
+}
+
+gboolean on_status_tick(gpointer data);
+
+void schedule_status_tick() {
+    if (status_timer_id || status_paused || !status_modules || status_modules->len == 0) return;
+    
+    /* Modules update on multiples of their interval in wall-clock time,
+       so they all share one wakeup whenever their boundaries coincide. */
+    gint64 now_us = g_get_real_time();
+    gint64 now = now_us / G_USEC_PER_SEC;
+    gint64 next = G_MAXINT64;
+    for (guint i = 0; i < status_modules->len; i++) {
+        StatusModule *module = g_ptr_array_index(status_modules, i);
+        next = MIN(next, (now / module->type->interval + 1) * module->type->interval);
+    }
+    guint delay = (next * G_USEC_PER_SEC - now_us) / 1000 + STATUS_TICK_SLACK_MS;
+    status_timer_id = g_timeout_add(delay, on_status_tick, NULL);
+}
+
+gboolean on_status_tick(gpointer data) {
+    status_timer_id = 0;
+    update_status_modules(FALSE);
+    schedule_status_tick();
+    return G_SOURCE_REMOVE;
+}
+
+void stop_status_timer() {
+    if (status_timer_id) {
+        g_source_remove(status_timer_id);
+        status_timer_id = 0;
+    }
+}
+
+gboolean on_window_map_event(GtkWidget *widget, GdkEvent *event, gpointer user_data) {
+    status_paused = FALSE;
+    update_status_modules(TRUE);
+    schedule_status_tick();
+    return FALSE;
+}
+
+gboolean on_window_unmap_event(GtkWidget *widget, GdkEvent *event, gpointer user_data) {
+    status_paused = TRUE;
+    stop_status_timer();
+    return FALSE;
+}
+
+void build_status_modules() {
+    if (status_modules) {
+        g_ptr_array_free(status_modules, TRUE);
+    }
+    status_modules = g_ptr_array_new_with_free_func(g_free);
+    gtk_container_foreach(GTK_CONTAINER(status_box), (GtkCallback)gtk_widget_destroy, NULL);
+    stop_status_timer();
+    
+    char **names = g_strsplit(status_modules_setting ? status_modules_setting : STATUS_MODULES, ";", -1);
+    for (char **name = names; *name; name++) {
+        const StatusModuleType *type = NULL;
+        g_strstrip(*name);
+        if (!**name) continue;
+        
+        for (gsize i = 0; i < G_N_ELEMENTS(status_module_types); i++) {
+            if (strcmp(*name, status_module_types[i].name) == 0) {
+                type = &status_module_types[i];
+            }
+        }
+        if (!type) {
+            g_warning("Unknown status bar module: %s", *name);
+            continue;
+        }
+        if (type->format == format_battery && !sampler.battery_dir) {
+            sampler.battery_dir = find_battery_dir();
+            if (!sampler.battery_dir) continue;
+        }
+        
+        StatusModule *module = g_new0(StatusModule, 1);
+        module->type = type;
+        module->label = gtk_label_new("");
+        gtk_widget_set_valign(module->label, GTK_ALIGN_CENTER);
+        gtk_widget_set_no_show_all(module->label, TRUE);
+        gtk_box_pack_start(GTK_BOX(status_box), module->label, FALSE, FALSE, 0);
+        g_ptr_array_add(status_modules, module);
+    }
+    g_strfreev(names);
+    
+    update_status_modules(TRUE);
+    schedule_status_tick();
+}
+
+void free_status_modules() {
+    stop_status_timer();
+    g_clear_pointer(&status_modules, g_ptr_array_unref);
+    for (int i = 0; i < SAMPLE_SOURCES; i++) {
+        if (sampler.fds[i] >= 0) {
+            close(sampler.fds[i]);
+            sampler.fds[i] = -1;
+        }
+    }
+    g_clear_pointer(&sampler.battery_dir, g_free);
+    g_clear_pointer(&status_modules_setting, g_free);
 }
 
 void set_window_properties(GtkWidget *window) {
@@ -94,6 +843,10 @@ void set_window_properties(GtkWidget *window) {
 }
 
 const char *get_shell() {
+    if (shell_command && *shell_command) {
+        return shell_command;
+    }
+    
     const char *shell = g_getenv("SHELL");
     if (!shell || access(shell, X_OK) != 0) {
         shell = "/bin/bash";
@@ -104,32 +857,266 @@ const char *get_shell() {
     return shell;
 }
 
-void update_terminal_font() {
-    char font_desc[64];
-    snprintf(font_desc, sizeof(font_desc), "Courier New Bold %d", current_font_size);
-    
-    for (int i = 0; i < TAB_COUNT; i++) {
-        PangoFontDescription *font = pango_font_description_from_string(font_desc);
-        vte_terminal_set_font(VTE_TERMINAL(terminal_tabs[i]), font);
-        pango_font_description_free(font);
+PangoFontDescription *get_terminal_font() {
+    if (!terminal_font || terminal_font_size != current_font_size) {
+        char font_desc[64];
+        snprintf(font_desc, sizeof(font_desc), "Courier New Bold %d", current_font_size);
+        
+        if (terminal_font) {
+            pango_font_description_free(terminal_font);
+        }
+        terminal_font = pango_font_description_from_string(font_desc);
+        terminal_font_size = current_font_size;
     }
+    return terminal_font;
+}
+
+void apply_terminal_font(Tab *tab) {
+    if (tab->terminal && tab->font_size != current_font_size) {
+        vte_terminal_set_font(VTE_TERMINAL(tab->terminal), get_terminal_font());
+        tab->font_size = current_font_size;
+    }
+}
+
+void update_terminal_font() {
+    /* Every font change reflows the whole scrollback, so only the visible
+       tab is updated now; the others catch up in switch_to_tab(). */
+    Tab *tab = g_ptr_array_index(tabs, gtk_notebook_get_current_page(GTK_NOTEBOOK(notebook)));
+    apply_terminal_font(tab);
 }
 
 void change_font_size(int delta) {
+    gint64 trace = trace_begin();
     current_font_size += delta;
     
     if (current_font_size < MIN_FONT_SIZE) current_font_size = MIN_FONT_SIZE;
     if (current_font_size > MAX_FONT_SIZE) current_font_size = MAX_FONT_SIZE;
     
     update_terminal_font();
-    g_key_file_set_integer(config, "Settings", "font_size", current_font_size);
+    trace_end("change_font_size", trace);
+    trace_until_frame("font-change-to-frame", trace);
+    config_set_integer("Settings", "font_size", current_font_size);
+}
+
+void record_launch_id(const char *id);
+
+void on_shell_spawned(VteTerminal *terminal, GPid pid, GError *error, gpointer user_data) {
+    Tab *tab = g_object_get_data(G_OBJECT(terminal), "tab");
+    if (!tab) return;
+    
+    if (error) {
+        g_warning("Failed to start shell: %s", error->message);
+    } else {
+        tab->pid = pid;
+        if (tab->launch_id) {
+            record_launch_id(tab->launch_id);
+        }
+    }
+    g_clear_pointer(&tab->launch_id, g_free);
+    update_tab_info();
+}
+
+char **get_shell_environ() {
+    char version[16];
+    snprintf(version, sizeof(version), "%u", vte_get_major_version() * 10000 +
+             vte_get_minor_version() * 100 + vte_get_micro_version());
+    
+    char **env = g_get_environ();
+    env = g_environ_setenv(env, "TERM", "xterm-256color", TRUE);
+    env = g_environ_setenv(env, "COLORTERM", "truecolor", TRUE);
+    env = g_environ_setenv(env, "VTE_VERSION", version, TRUE);
+    return env;
+}
+
+gint64 available_memory_mb() {
+    char *data;
+    gint64 available = -1;
+    
+    if (!g_file_get_contents("/proc/meminfo", &data, NULL, NULL)) return -1;
+    char *line = strstr(data, "MemAvailable:");
+    if (line) {
+        available = g_ascii_strtoll(line + strlen("MemAvailable:"), NULL, 10) / 1024;
+    }
+    g_free(data);
+    return available;
+}
+
+gboolean memory_is_low() {
+    gint64 available = available_memory_mb();
+    return available >= 0 && available < pool_min_available_mb;
+}
+
+void free_pooled_shell(PooledShell *shell, gboolean kill_shell) {
+    if (shell->watch_id) {
+        g_source_remove(shell->watch_id);
+    }
+    if (kill_shell) {
+        kill(shell->pid, SIGHUP);
+        g_child_watch_add(shell->pid, on_closed_child_reaped, NULL);
+    }
+    g_object_unref(shell->pty);
+    g_free(shell->shell);
+    g_free(shell);
+}
+
+void trim_shell_pool(int size) {
+    while ((int)shell_pool.length > size) {
+        free_pooled_shell(g_queue_pop_tail(&shell_pool), TRUE);
+    }
+}
+
+void schedule_pool_refill();
+
+void on_pooled_shell_exited(GPid pid, gint status, gpointer user_data) {
+    PooledShell *shell = user_data;
+    
+    /* A shell that dies before it is used is most likely broken, e.g. a
+       bad rc file; stop respawning it after a few tries. */
+    g_spawn_close_pid(pid);
+    shell->watch_id = 0;
+    g_queue_remove(&shell_pool, shell);
+    free_pooled_shell(shell, FALSE);
+    pool_failures++;
+    schedule_pool_refill();
+}
+
+void on_pool_shell_spawned(GObject *source, GAsyncResult *result, gpointer user_data) {
+    VtePty *pty = VTE_PTY(source);
+    char *shell_path = user_data;
+    GError *error = NULL;
+    GPid pid;
+    
+    pool_spawning = FALSE;
+    if (!vte_pty_spawn_finish(pty, result, &pid, &error)) {
+        g_warning("Failed to start pooled shell: %s", error->message);
+        g_error_free(error);
+        g_object_unref(pty);
+        g_free(shell_path);
+        pool_failures++;
+        schedule_pool_refill();
+        return;
+    }
+    
+    PooledShell *shell = g_new0(PooledShell, 1);
+    shell->pty = pty;
+    shell->pid = pid;
+    shell->shell = shell_path;
+    shell->watch_id = g_child_watch_add(pid, on_pooled_shell_exited, shell);
+    g_queue_push_tail(&shell_pool, shell);
+    
+    /* The settings may have changed while it was starting. */
+    if (strcmp(shell_path, get_shell()) != 0) {
+        g_queue_remove(&shell_pool, shell);
+        free_pooled_shell(shell, TRUE);
+    }
+    trim_shell_pool(pool_size);
+    schedule_pool_refill();
+}
+
+gboolean refill_shell_pool(gpointer data) {
+    pool_refill_id = 0;
+    if (memory_is_low()) {
+        trim_shell_pool(0);
+        return G_SOURCE_REMOVE;
+    }
+    if (pool_spawning || (int)shell_pool.length >= pool_size || pool_failures >= POOL_MAX_FAILURES) {
+        return G_SOURCE_REMOVE;
+    }
+    
+    GError *error = NULL;
+    VtePty *pty = vte_pty_new_sync(VTE_PTY_DEFAULT, NULL, &error);
+    if (!pty) {
+        g_warning("Failed to open a PTY for the shell pool: %s", error->message);
+        g_error_free(error);
+        pool_failures++;
+        return G_SOURCE_REMOVE;
+    }
+    
+    char *shell_argv[] = { (char *)get_shell(), NULL };
+    char **env = get_shell_environ();
+    pool_spawning = TRUE;
+    vte_pty_spawn_async(pty, NULL, shell_argv, env,
+                        G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                        NULL, NULL, NULL, -1, NULL, on_pool_shell_spawned, g_strdup(shell_argv[0]));
+    g_strfreev(env);
+    return G_SOURCE_REMOVE;
+}
+
+#if GLIB_CHECK_VERSION(2, 78, 0)
+void on_low_memory_warning(GMemoryMonitor *monitor, GMemoryMonitorWarningLevel level, gpointer data) {
+    trim_shell_pool(0);
+}
+#else
+gboolean on_pool_check(gpointer data) {
+    if (shell_pool.length == 0) {
+        pool_check_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+    if (memory_is_low()) {
+        trim_shell_pool(0);
+    }
+    return G_SOURCE_CONTINUE;
+}
+#endif
+
+void watch_pool_memory() {
+    /* Idle pooled shells go under memory pressure even when nothing
+       takes one. GLib's PSI monitor reports it; without it MemAvailable
+       is polled while the pool holds shells. */
+#if GLIB_CHECK_VERSION(2, 78, 0)
+    if (!memory_monitor && pool_size > 0) {
+        memory_monitor = g_memory_monitor_dup_default();
+        g_signal_connect(memory_monitor, "low-memory-warning", G_CALLBACK(on_low_memory_warning), NULL);
+    }
+#else
+    if (!pool_check_id && shell_pool.length > 0) {
+        pool_check_id = g_timeout_add_seconds(POOL_CHECK_INTERVAL, on_pool_check, NULL);
+    }
+#endif
+}
+
+void schedule_pool_refill() {
+    watch_pool_memory();
     
-    char *config_dir = g_build_filename(g_get_home_dir(), CONFIG_FILE, NULL);
-    g_key_file_save_to_file(config, config_dir, NULL);
-    g_free(config_dir);
+    /* Shells start one at a time at idle priority, so refilling never
+       competes with drawing or input. */
+    if (!pool_refill_id && !pool_spawning && (int)shell_pool.length < pool_size) {
+        pool_refill_id = g_idle_add_full(G_PRIORITY_LOW, refill_shell_pool, NULL, NULL);
+    }
+}
+
+PooledShell *take_pooled_shell() {
+    PooledShell *shell = g_queue_pop_head(&shell_pool);
+    if (shell) {
+        g_source_remove(shell->watch_id);
+        shell->watch_id = 0;
+        pool_failures = 0;
+    }
+    schedule_pool_refill();
+    return shell;
+}
+
+void free_shell_pool() {
+    trim_shell_pool(0);
+    if (pool_refill_id) {
+        g_source_remove(pool_refill_id);
+        pool_refill_id = 0;
+    }
+#if GLIB_CHECK_VERSION(2, 78, 0)
+    if (memory_monitor) {
+        g_signal_handlers_disconnect_by_func(memory_monitor, on_low_memory_warning, NULL);
+        g_clear_object(&memory_monitor);
+    }
+#else
+    if (pool_check_id) {
+        g_source_remove(pool_check_id);
+        pool_check_id = 0;
+    }
+#endif
 }
 
-GtkWidget *create_terminal_tab(int tab_num) {
+GtkWidget *create_terminal_tab(Tab *tab) {
+    gint64 trace = trace_begin();
     GtkWidget *terminal = vte_terminal_new();
     VteTerminal *vte_term = VTE_TERMINAL(terminal);
     
@@ -157,27 +1144,58 @@ GtkWidget *create_terminal_tab(int tab_num) {
     };
     vte_terminal_set_colors(vte_term, NULL, NULL, palette, 16);
     
-    update_terminal_font();
+    vte_terminal_set_font(vte_term, get_terminal_font());
+    tab->font_size = current_font_size;
+    g_object_set_data(G_OBJECT(terminal), "tab", tab);
+    
+    vte_terminal_set_scrollback_lines(vte_term, scrollback_lines);
+    tab->scrollback_lines = scrollback_lines;
     
-    const char *shell = get_shell();
-    char *shell_argv[] = { (char *)shell, NULL };
-    vte_terminal_spawn_async(vte_term,
-                             VTE_PTY_DEFAULT,
-                             NULL,
-                             shell_argv,
-                             NULL,
-                             G_SPAWN_SEARCH_PATH,
-                             NULL, NULL, NULL, -1, NULL, NULL, NULL);
+    PooledShell *pooled = tab->argv || tab->workdir ? NULL : take_pooled_shell();
+    if (pooled) {
+        vte_terminal_set_pty(vte_term, pooled->pty);
+        vte_terminal_watch_child(vte_term, pooled->pid);
+        tab->pid = pooled->pid;
+        free_pooled_shell(pooled, FALSE);
+    } else {
+        const char *shell = get_shell();
+        char *shell_argv[] = { (char *)shell, NULL };
+        vte_terminal_spawn_async(vte_term,
+                                 VTE_PTY_DEFAULT,
+                                 tab->workdir,
+                                 tab->argv ? tab->argv : shell_argv,
+                                 NULL,
+                                 G_SPAWN_SEARCH_PATH,
+                                 NULL, NULL, NULL, -1, NULL, on_shell_spawned, NULL);
+    }
     
+    trace_end("create_terminal_tab", trace);
     return terminal;
 }
 
-void update_tab_info(int tab_num) {
-    char info_text[32];
-    snprintf(info_text, sizeof(info_text), "ATermD - %d/%d | ALT+1..0", tab_num + 1, TAB_COUNT);
-    gtk_label_set_text(GTK_LABEL(tab_info_label), info_text);
-}
-
+void update_tab_info() {
+    int current_page = gtk_notebook_get_current_page(GTK_NOTEBOOK(notebook));
+    int live = 0;
+    
+    for (guint i = 0; i < tabs->len; i++) {
+        Tab *tab = g_ptr_array_index(tabs, i);
+        if (tab->pid > 0) live++;
+    }
+    
+    GString *info_text = g_string_new(NULL);
+    g_string_printf(info_text, "ATermD - %d/%u (%d live) | ", current_page + 1, tabs->len, live);
+    for (guint i = 0; i < tabs->len; i++) {
+        Tab *tab = g_ptr_array_index(tabs, i);
+        if (tab->bell || tab->activity) {
+            g_string_append_printf(info_text, "%u%s ", i + 1, tab->bell ? "!" : "*");
+        }
+    }
+    g_string_append(info_text, "| ALT+1..0");
+    gtk_label_set_text(GTK_LABEL(tab_info_label), info_text->str);
+    g_string_free(info_text, TRUE);
+    update_transfer_progress();
+}
+
 void show_about_dialog(GtkWidget *widget, gpointer data) {
     about_dialog = gtk_message_dialog_new(GTK_WINDOW(window),
                                       GTK_DIALOG_MODAL,
@@ -201,10 +1219,13 @@ void show_help_dialog(GtkWidget *widget, gpointer data) {
                                       "ATermD Controls");
     gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(help_dialog),
                                            "ALT+1..0 - Switch tabs\n"
+                                           "ALT+T - New tab\n"
+                                           "ALT+W - Close tab\n"
                                            "ALT+D - Open AmenuD\n"
                                            "ALT+H - Hide/show window\n"
                                            "ALT+L - Clear terminal\n"
                                            "CTRL++/- - Change font size\n"
+                                           "SHIFT+PGUP at top - Older scrollback\n"
                                            "Super/Win - Open obconf\n"
                                            "Right click - Context menu");
     gtk_window_set_title(GTK_WINDOW(help_dialog), "ATermD Controls");
@@ -212,103 +1233,1400 @@ void show_help_dialog(GtkWidget *widget, gpointer data) {
     gtk_widget_destroy(help_dialog);
 }
 
-void copy_text(GtkWidget *widget, gpointer data) {
-    int current_page = gtk_notebook_get_current_page(GTK_NOTEBOOK(notebook));
-    vte_terminal_copy_clipboard_format(VTE_TERMINAL(terminal_tabs[current_page]),
-                                     VTE_FORMAT_TEXT);
+char *get_terminal_text(VteTerminal *terminal, glong start_row, glong start_col, glong end_row, glong end_col) {
+#if VTE_CHECK_VERSION(0, 76, 0)
+    /* The _format variant takes an exclusive end column. */
+    return vte_terminal_get_text_range_format(terminal, VTE_FORMAT_TEXT, start_row, start_col,
+                                              end_row, end_col + 1, NULL);
+#else
+    return vte_terminal_get_text_range(terminal, start_row, start_col, end_row, end_col, NULL, NULL, NULL);
+#endif
+}
+
+void copy_text(GtkWidget *widget, gpointer data) {
+    vte_terminal_copy_clipboard_format(VTE_TERMINAL(current_terminal()), VTE_FORMAT_TEXT);
+}
+
+gboolean append_file(const char *path, const char *data, gsize length, gboolean gzip, GError **error) {
+    GFile *file = g_file_new_for_path(path);
+    GFileOutputStream *out = g_file_append_to(file, G_FILE_CREATE_PRIVATE, NULL, error);
+    g_object_unref(file);
+    if (!out) return FALSE;
+    
+    GZlibCompressor *compressor = NULL;
+    GOutputStream *stream = g_object_ref(out);
+    if (gzip) {
+        compressor = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+        g_object_unref(stream);
+        stream = g_converter_output_stream_new(G_OUTPUT_STREAM(out), G_CONVERTER(compressor));
+    }
+    gboolean ok = g_output_stream_write_all(stream, data, length, NULL, NULL, error) &&
+                  g_output_stream_close(stream, NULL, error);
+    
+    g_object_unref(stream);
+    g_clear_object(&compressor);
+    g_object_unref(out);
+    return ok;
+}
+
+void write_file_job(gpointer data, gpointer user_data) {
+    FileWrite *job = data;
+    GError *error = NULL;
+    gboolean ok = TRUE;
+    
+    switch (job->mode) {
+        case FILE_WRITE_REPLACE:
+            ok = g_file_set_contents(job->path, job->contents, job->length, &error);
+            break;
+        case FILE_WRITE_APPEND:
+            ok = append_file(job->path, job->contents, job->length, FALSE, &error);
+            break;
+        case FILE_WRITE_APPEND_GZIP:
+            ok = append_file(job->path, job->contents, job->length, TRUE, &error);
+            break;
+        case FILE_WRITE_DELETE:
+            g_unlink(job->path);
+            break;
+    }
+    if (!ok) {
+        g_warning("Failed to save %s: %s", job->path, error->message);
+        g_error_free(error);
+    }
+    
+    g_free(job->path);
+    g_free(job->contents);
+    g_free(job);
+}
+
+void queue_file_write(FileWriteMode mode, const char *path, char *contents, gsize length) {
+    if (!file_writer) {
+        file_writer = g_thread_pool_new(write_file_job, NULL, 1, FALSE, NULL);
+    }
+    
+    FileWrite *job = g_new(FileWrite, 1);
+    job->mode = mode;
+    job->path = g_strdup(path);
+    job->contents = contents;
+    job->length = length;
+    g_thread_pool_push(file_writer, job, NULL);
+}
+
+void write_file_async(const char *path, char *contents, gsize length) {
+    queue_file_write(FILE_WRITE_REPLACE, path, contents, length);
+}
+
+void flush_file_writer() {
+    if (file_writer) {
+        g_thread_pool_free(file_writer, FALSE, TRUE);
+        file_writer = NULL;
+    }
+}
+
+Tab *tab_at(int tab_num);
+
+void update_transfer_progress() {
+    Tab *tab = tab_at(gtk_notebook_get_current_page(GTK_NOTEBOOK(notebook)));
+    Transfer *transfer = tab ? tab->transfer : NULL;
+    if (!transfer) {
+        gtk_widget_hide(transfer_box);
+        return;
+    }
+    
+    double fraction;
+    if (transfer->kind == TRANSFER_PASTE) {
+        fraction = (double)transfer->offset / MAX(transfer->length, 1);
+    } else {
+        fraction = (double)(transfer->row - transfer->first_row) / MAX(transfer->end_row - transfer->first_row, 1);
+    }
+    char *text = g_strdup_printf("%s %d%%", transfer->kind == TRANSFER_PASTE ? "Pasting" : "Saving",
+                                 (int)(fraction * 100));
+    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(transfer_progress), fraction);
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(transfer_progress), text);
+    gtk_widget_show(transfer_box);
+    g_free(text);
+}
+
+void free_transfer(Transfer *transfer) {
+    if (!transfer) return;
+    
+    if (transfer->source_id) {
+        g_source_remove(transfer->source_id);
+    }
+    g_free(transfer->text);
+    g_free(transfer->path);
+    g_free(transfer);
+}
+
+void finish_transfer(Tab *tab, gboolean cancelled) {
+    Transfer *transfer = tab->transfer;
+    if (!transfer) return;
+    
+    if (cancelled && transfer->kind == TRANSFER_SAVE) {
+        queue_file_write(FILE_WRITE_DELETE, transfer->path, NULL, 0);
+    }
+    tab->transfer = NULL;
+    free_transfer(transfer);
+    update_transfer_progress();
+}
+
+void on_transfer_cancel(GtkWidget *widget, gpointer data) {
+    Tab *tab = tab_at(gtk_notebook_get_current_page(GTK_NOTEBOOK(notebook)));
+    if (tab) {
+        finish_transfer(tab, TRUE);
+    }
+}
+
+void send_paste_chunk(VteTerminal *terminal, const char *text, gsize length) {
+    char *chunk = g_strndup(text, length);
+#if VTE_CHECK_VERSION(0, 68, 0)
+    /* Brackets the chunk only if the program asked for bracketed paste;
+       a program that did sees several pastes in a row. */
+    vte_terminal_paste_text(terminal, chunk);
+#else
+    g_strdelimit(chunk, "\n", '\r');
+    vte_terminal_feed_child(terminal, chunk, length);
+#endif
+    g_free(chunk);
+}
+
+gboolean on_paste_writable(gint fd, GIOCondition condition, gpointer data) {
+    Transfer *transfer = data;
+    Tab *tab = g_object_get_data(G_OBJECT(transfer->terminal), "tab");
+    
+    if (condition & (G_IO_HUP | G_IO_ERR)) {
+        transfer->source_id = 0;
+        finish_transfer(tab, TRUE);
+        return G_SOURCE_REMOVE;
+    }
+    
+    /* One chunk per wakeup, and only while the PTY has room, so a huge
+       paste never piles up in VTE's output buffer. */
+    const char *start = transfer->text + transfer->offset;
+    gsize left = transfer->length - transfer->offset;
+    gsize length = MIN(left, PASTE_CHUNK_SIZE);
+    while (length < left && length > 0 && (start[length] & 0xC0) == 0x80) {
+        length--;
+    }
+    if (length == 0) {
+        length = MIN(left, PASTE_CHUNK_SIZE);
+    }
+    
+    send_paste_chunk(VTE_TERMINAL(transfer->terminal), start, length);
+    transfer->offset += length;
+    if (transfer->offset == transfer->length) {
+        transfer->source_id = 0;
+        finish_transfer(tab, FALSE);
+        return G_SOURCE_REMOVE;
+    }
+    update_transfer_progress();
+    return G_SOURCE_CONTINUE;
+}
+
+void on_paste_text_received(GtkClipboard *board, const gchar *text, gpointer data) {
+    GtkWidget *terminal = data;
+    Tab *tab = g_object_get_data(G_OBJECT(terminal), "tab");
+    VtePty *pty = tab ? vte_terminal_get_pty(VTE_TERMINAL(terminal)) : NULL;
+    gsize length = text ? strlen(text) : 0;
+    
+    if (pty && length > 0 && !tab->transfer) {
+        if (length < PASTE_CHUNKED_MIN) {
+#if VTE_CHECK_VERSION(0, 68, 0)
+            vte_terminal_paste_text(VTE_TERMINAL(terminal), text);
+#else
+            vte_terminal_paste_clipboard(VTE_TERMINAL(terminal));
+#endif
+        } else {
+            Transfer *transfer = g_new0(Transfer, 1);
+            transfer->kind = TRANSFER_PASTE;
+            transfer->terminal = terminal;
+            transfer->text = g_strdup(text);
+            transfer->length = length;
+            transfer->source_id = g_unix_fd_add_full(G_PRIORITY_LOW, vte_pty_get_fd(pty), G_IO_OUT,
+                                                     on_paste_writable, transfer, NULL);
+            tab->transfer = transfer;
+            update_transfer_progress();
+        }
+    }
+    g_object_unref(terminal);
+}
+
+void paste_text(GtkWidget *widget, gpointer data) {
+    gtk_clipboard_request_text(clipboard, on_paste_text_received, g_object_ref(current_terminal()));
+}
+
+gboolean on_save_scrollback_idle(gpointer data) {
+    Transfer *transfer = data;
+    Tab *tab = g_object_get_data(G_OBJECT(transfer->terminal), "tab");
+    VteTerminal *vte_term = VTE_TERMINAL(transfer->terminal);
+    glong last = MIN(transfer->row + SAVE_CHUNK_ROWS, transfer->end_row) - 1;
+    
+    /* A slice of rows per idle pass, handed to the writer thread, so the
+       whole scrollback never sits in one string on the main thread. */
+    char *text = get_terminal_text(vte_term, transfer->row, 0, last,
+                                   vte_terminal_get_column_count(vte_term) - 1);
+    if (text) {
+        queue_file_write(FILE_WRITE_APPEND, transfer->path, text, strlen(text));
+    }
+    
+    transfer->row = last + 1;
+    if (transfer->row >= transfer->end_row) {
+        transfer->source_id = 0;
+        finish_transfer(tab, FALSE);
+        return G_SOURCE_REMOVE;
+    }
+    update_transfer_progress();
+    return G_SOURCE_CONTINUE;
+}
+
+void start_scrollback_save(Tab *tab, const char *path) {
+    GtkAdjustment *adjustment = gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(tab->terminal));
+    Transfer *transfer = g_new0(Transfer, 1);
+    transfer->kind = TRANSFER_SAVE;
+    transfer->terminal = tab->terminal;
+    transfer->path = g_strdup(path);
+    transfer->first_row = (glong)gtk_adjustment_get_lower(adjustment);
+    transfer->row = transfer->first_row;
+    transfer->end_row = (glong)gtk_adjustment_get_upper(adjustment);
+    
+    queue_file_write(FILE_WRITE_REPLACE, path, g_strdup(""), 0);
+    transfer->source_id = g_idle_add(on_save_scrollback_idle, transfer);
+    tab->transfer = transfer;
+    update_transfer_progress();
+}
+
+void save_scrollback(GtkWidget *widget, gpointer data) {
+    GtkWidget *terminal = current_terminal();
+    GtkWidget *dialog = gtk_file_chooser_dialog_new("Save Scrollback", GTK_WINDOW(window),
+                                                    GTK_FILE_CHOOSER_ACTION_SAVE,
+                                                    "_Cancel", GTK_RESPONSE_CANCEL,
+                                                    "_Save", GTK_RESPONSE_ACCEPT, NULL);
+    gtk_file_chooser_set_do_overwrite_confirmation(GTK_FILE_CHOOSER(dialog), TRUE);
+    gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(dialog), "scrollback.txt");
+    
+    g_object_ref(terminal);
+    if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+        Tab *tab = g_object_get_data(G_OBJECT(terminal), "tab");
+        char *path = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
+        if (tab && path && !tab->transfer) {
+            start_scrollback_save(tab, path);
+        }
+        g_free(path);
+    }
+    g_object_unref(terminal);
+    gtk_widget_destroy(dialog);
+}
+
+double launch_frecency(const char *id) {
+    LaunchRecord *record = launch_history ? g_hash_table_lookup(launch_history, id) : NULL;
+    if (!record) return 0;
+    
+    gint64 age = g_get_real_time() / G_USEC_PER_SEC - record->last_used;
+    return record->score * exp2(-MAX(age, 0) / HISTORY_HALF_LIFE);
+}
+
+int launch_boost(const char *id) {
+    return (int)(MIN(launch_frecency(id), 10.0) * 30);
+}
+
+void load_history() {
+    launch_history = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    
+    char *path = g_build_filename(g_get_home_dir(), HISTORY_FILE, NULL);
+    char *contents;
+    if (g_file_get_contents(path, &contents, NULL, NULL)) {
+        char **lines = g_strsplit(contents, "\n", -1);
+        for (int i = 0; lines[i]; i++) {
+            char *end;
+            double score = g_ascii_strtod(lines[i], &end);
+            if (end == lines[i] || *end != ' ') continue;
+            
+            char *start = end + 1;
+            gint64 last_used = g_ascii_strtoll(start, &end, 10);
+            if (end == start || *end != ' ' || end[1] == '\0') continue;
+            
+            LaunchRecord *record = g_new(LaunchRecord, 1);
+            record->score = score;
+            record->last_used = last_used;
+            g_hash_table_replace(launch_history, g_strdup(end + 1), record);
+        }
+        g_strfreev(lines);
+        g_free(contents);
+    }
+    g_free(path);
+}
+
+gint compare_frecency(gconstpointer a, gconstpointer b) {
+    double x = launch_frecency(*(const char **)a);
+    double y = launch_frecency(*(const char **)b);
+    return (x < y) - (x > y);
+}
+
+void save_history() {
+    GPtrArray *ids = g_ptr_array_new();
+    GHashTableIter iter;
+    gpointer key;
+    
+    g_hash_table_iter_init(&iter, launch_history);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        g_ptr_array_add(ids, key);
+    }
+    g_ptr_array_sort(ids, compare_frecency);
+    
+    GString *contents = g_string_new(NULL);
+    for (guint i = 0; i < ids->len; i++) {
+        const char *id = g_ptr_array_index(ids, i);
+        if (i >= HISTORY_MAX_ENTRIES || launch_frecency(id) < HISTORY_MIN_SCORE) {
+            g_hash_table_remove(launch_history, id);
+            continue;
+        }
+        
+        LaunchRecord *record = g_hash_table_lookup(launch_history, id);
+        char score[G_ASCII_DTOSTR_BUF_SIZE];
+        g_ascii_formatd(score, sizeof(score), "%.4f", record->score);
+        g_string_append_printf(contents, "%s %" G_GINT64_FORMAT " %s\n", score, record->last_used, id);
+    }
+    g_ptr_array_free(ids, TRUE);
+    
+    char *path = g_build_filename(g_get_home_dir(), HISTORY_FILE, NULL);
+    gsize length = contents->len;
+    write_file_async(path, g_string_free(contents, FALSE), length);
+    g_free(path);
+}
+
+gboolean on_history_save(gpointer data) {
+    history_save_id = 0;
+    save_history();
+    return G_SOURCE_REMOVE;
+}
+
+void schedule_history_save() {
+    history_serial++;
+    if (!history_save_id) {
+        history_save_id = g_timeout_add_seconds(HISTORY_SAVE_DELAY, on_history_save, NULL);
+    }
+}
+
+void forget_launch(const char *id) {
+    if (g_hash_table_remove(launch_history, id)) {
+        schedule_history_save();
+    }
+}
+
+void prune_history() {
+    GHashTableIter iter;
+    gpointer key;
+    gboolean pruned = FALSE;
+    
+    /* Apps uninstalled while atermd was not running. */
+    g_hash_table_iter_init(&iter, launch_history);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        if (!g_hash_table_contains(app_index, key)) {
+            g_hash_table_iter_remove(&iter);
+            pruned = TRUE;
+        }
+    }
+    if (pruned) {
+        schedule_history_save();
+    }
+}
+
+void record_launch(DesktopApp *app) {
+    LaunchRecord *record = g_hash_table_lookup(launch_history, app->id);
+    double score = launch_frecency(app->id);
+    
+    if (!record) {
+        record = g_new(LaunchRecord, 1);
+        g_hash_table_insert(launch_history, g_strdup(app->id), record);
+    }
+    record->score = score + 1;
+    record->last_used = g_get_real_time() / G_USEC_PER_SEC;
+    
+    if (app->match_item) {
+        amatch_set_boost(app->match_item, launch_boost(app->id));
+    }
+    schedule_history_save();
+}
+
+void record_launch_id(const char *id) {
+    DesktopApp *app = g_hash_table_lookup(app_index, id);
+    if (app) {
+        record_launch(app);
+    }
+}
+
+void flush_history() {
+    if (history_save_id) {
+        g_source_remove(history_save_id);
+        history_save_id = 0;
+        save_history();
+    }
+    flush_file_writer();
+    g_clear_pointer(&launch_history, g_hash_table_destroy);
+}
+
+void append_quoted(GString *command, const char *value) {
+    char *quoted = g_shell_quote(value);
+    g_string_append(command, quoted);
+    g_free(quoted);
+}
+
+char **expand_exec(const DesktopApp *app, GError **error) {
+    GString *command = g_string_new(NULL);
+    
+    /* Field codes are expanded to shell-quoted text first, then the line is
+       split with the spec's (shell-like) quoting rules. No files or URLs
+       are passed from the menus, so %f/%F/%u/%U expand to nothing. */
+    for (const char *p = app->exec; *p; p++) {
+        if (*p != '%') {
+            g_string_append_c(command, *p);
+            continue;
+        }
+        
+        switch (*++p) {
+            case '%':
+                g_string_append_c(command, '%');
+                break;
+            case 'i':
+                if (app->icon) {
+                    g_string_append(command, "--icon ");
+                    append_quoted(command, app->icon);
+                }
+                break;
+            case 'c':
+                append_quoted(command, app->name);
+                break;
+            case 'k':
+                append_quoted(command, app->path);
+                break;
+            case '\0':
+                p--;
+                break;
+            default:
+                break;
+        }
+    }
+    
+    char **argv = NULL;
+    g_shell_parse_argv(command->str, NULL, &argv, error);
+    g_string_free(command, TRUE);
+    return argv;
+}
+
+const char *resolve_program(const char *program) {
+    if (strchr(program, '/')) return program;
+    
+    const char *path_env = g_getenv("PATH");
+    if (!exec_path_cache || g_strcmp0(path_env, exec_path_env) != 0) {
+        if (exec_path_cache) g_hash_table_destroy(exec_path_cache);
+        exec_path_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+        g_free(exec_path_env);
+        exec_path_env = g_strdup(path_env);
+    }
+    
+    char *resolved = g_hash_table_lookup(exec_path_cache, program);
+    if (!resolved) {
+        resolved = g_find_program_in_path(program);
+        if (!resolved) return NULL;
+        g_hash_table_insert(exec_path_cache, g_strdup(program), resolved);
+    }
+    return resolved;
+}
+
+void forget_program(const char *program) {
+    if (exec_path_cache) {
+        g_hash_table_remove(exec_path_cache, program);
+    }
+}
+
+void on_launched_child_exited(GPid pid, gint status, gpointer user_data) {
+    g_spawn_close_pid(pid);
+}
+
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2, 34)
+#define HAVE_SPAWN_CLOSEFROM 1
+#endif
+#if __GLIBC_PREREQ(2, 29)
+#define HAVE_SPAWN_CHDIR 1
+#endif
+#endif
+
+#ifndef HAVE_SPAWN_CLOSEFROM
+void add_spawn_closes(posix_spawn_file_actions_t *actions) {
+    int max_fd = STDERR_FILENO;
+    GDir *dir = g_dir_open("/proc/self/fd", 0, NULL);
+    
+    if (dir) {
+        const char *name;
+        while ((name = g_dir_read_name(dir)) != NULL) {
+            max_fd = MAX(max_fd, atoi(name));
+        }
+        g_dir_close(dir);
+    } else {
+        max_fd = (int)MIN(sysconf(_SC_OPEN_MAX), 4096);
+    }
+    
+    /* Closing an fd that is not open does not fail the spawn. */
+    for (int fd = STDERR_FILENO + 1; fd <= max_fd; fd++) {
+        posix_spawn_file_actions_addclose(actions, fd);
+    }
+}
+#endif
+
+#ifndef HAVE_SPAWN_CHDIR
+void setsid_child(gpointer data) {
+    setsid();
+}
+
+int spawn_program_in(const char *path, char **argv, const char *workdir, GPid *pid) {
+    guint argc = g_strv_length(argv);
+    char **file_argv = g_new(char *, argc + 2);
+    GError *error = NULL;
+    int err = 0;
+    
+    file_argv[0] = (char *)path;
+    memcpy(file_argv + 1, argv, (argc + 1) * sizeof(char *));
+    if (!g_spawn_async(workdir, file_argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_FILE_AND_ARGV_ZERO,
+                       setsid_child, NULL, pid, &error)) {
+        err = g_error_matches(error, G_SPAWN_ERROR, G_SPAWN_ERROR_NOENT) ? ENOENT :
+              g_error_matches(error, G_SPAWN_ERROR, G_SPAWN_ERROR_CHDIR) ? ENOTDIR : EIO;
+        g_error_free(error);
+    }
+    g_free(file_argv);
+    return err;
+}
+#endif
+
+int spawn_program(const char *path, char **argv, const char *workdir, GPid *pid) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t mask, defaults;
+    
+#ifndef HAVE_SPAWN_CHDIR
+    /* Without addchdir_np, posix_spawn cannot start in another directory. */
+    if (workdir) {
+        return spawn_program_in(path, argv, workdir, pid);
+    }
+#endif
+    
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+#ifdef HAVE_SPAWN_CLOSEFROM
+    posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+#else
+    add_spawn_closes(&actions);
+#endif
+#ifdef HAVE_SPAWN_CHDIR
+    if (workdir) {
+        posix_spawn_file_actions_addchdir_np(&actions, workdir);
+    }
+#endif
+    
+    sigemptyset(&mask);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGCHLD);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+#ifdef POSIX_SPAWN_SETSID
+    flags |= POSIX_SPAWN_SETSID;
+#endif
+#ifdef POSIX_SPAWN_USEVFORK
+    flags |= POSIX_SPAWN_USEVFORK;
+#endif
+    posix_spawnattr_setflags(&attr, flags);
+    
+    int err = posix_spawn(pid, path, &actions, &attr, argv, environ);
+    
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return err;
+}
+
+gboolean launch_argv(char **argv, const char *workdir, GError **error) {
+    gint64 start = g_get_monotonic_time();
+    const char *path = resolve_program(argv[0]);
+    GPid pid;
+    int err = path ? spawn_program(path, argv, workdir, &pid) : ENOENT;
+    
+    if (err == ENOENT && path && path != argv[0]) {
+        /* The binary moved since it was cached; look it up once more. */
+        forget_program(argv[0]);
+        path = resolve_program(argv[0]);
+        err = path ? spawn_program(path, argv, workdir, &pid) : ENOENT;
+    }
+    if (err != 0) {
+        g_set_error(error, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED, "Failed to execute \"%s\": %s",
+                    argv[0], g_strerror(err));
+        return FALSE;
+    }
+    g_child_watch_add(pid, on_launched_child_exited, NULL);
+    
+    gint64 elapsed = g_get_monotonic_time() - start;
+    launch_stats.count++;
+    launch_stats.total_us += elapsed;
+    launch_stats.max_us = MAX(launch_stats.max_us, elapsed);
+    g_debug("Launched %s in %.2f ms (average %.2f ms over %u launches)", argv[0], elapsed / 1000.0,
+            launch_stats.total_us / 1000.0 / launch_stats.count, launch_stats.count);
+    return TRUE;
+}
+
+void launch_app(GtkWidget *widget, gpointer data) {
+    DesktopApp *app = g_hash_table_lookup(app_index, (const char *)data);
+    if (!app || !app->exec) return;
+    
+    GError *error = NULL;
+    char **argv = expand_exec(app, &error);
+    if (!argv) {
+        g_warning("Invalid Exec line in %s: %s", app->path, error->message);
+        g_error_free(error);
+        return;
+    }
+    
+    if (app->terminal) {
+        /* Recorded once the tab's child has actually started. */
+        run_in_new_tab(argv, app->workdir, app->id);
+    } else if (launch_argv(argv, app->workdir, &error)) {
+        record_launch(app);
+    } else {
+        g_warning("%s", error->message);
+        g_error_free(error);
+    }
+    g_strfreev(argv);
+}
+
+void launch_obconf(GtkWidget *widget, gpointer data) {
+    char *argv[] = { "obconf", NULL };
+    GError *error = NULL;
+    
+    if (!launch_argv(argv, NULL, &error)) {
+        g_warning("%s", error->message);
+        g_error_free(error);
+    }
+}
+
+void free_desktop_app(DesktopApp *app) {
+    if (app->match_item) {
+        amatch_remove(app_matcher, app->match_item);
+    }
+    g_free(app->id);
+    g_free(app->path);
+    g_free(app->name);
+    g_free(app->generic_name);
+    g_free(app->exec);
+    g_free(app->icon);
+    g_strfreev(app->keywords);
+    g_strfreev(app->categories);
+    g_free(app->workdir);
+    g_free(app);
+}
+
+DesktopApp *load_desktop_app(const char *id, const char *path) {
+    GKeyFile *key_file = g_key_file_new();
+    if (!g_key_file_load_from_file(key_file, path, G_KEY_FILE_NONE, NULL) ||
+        !g_key_file_has_group(key_file, "Desktop Entry")) {
+        g_key_file_free(key_file);
+        return NULL;
+    }
+    
+    DesktopApp *app = g_new0(DesktopApp, 1);
+    app->id = g_strdup(id);
+    app->path = g_strdup(path);
+    app->name = g_key_file_get_locale_string(key_file, "Desktop Entry", "Name", NULL, NULL);
+    app->generic_name = g_key_file_get_locale_string(key_file, "Desktop Entry", "GenericName", NULL, NULL);
+    app->exec = g_key_file_get_string(key_file, "Desktop Entry", "Exec", NULL);
+    app->icon = g_key_file_get_string(key_file, "Desktop Entry", "Icon", NULL);
+    app->keywords = g_key_file_get_locale_string_list(key_file, "Desktop Entry", "Keywords", NULL, NULL, NULL);
+    app->categories = g_key_file_get_string_list(key_file, "Desktop Entry", "Categories", NULL, NULL);
+    app->no_display = g_key_file_get_boolean(key_file, "Desktop Entry", "NoDisplay", NULL);
+    app->hidden = g_key_file_get_boolean(key_file, "Desktop Entry", "Hidden", NULL);
+    app->terminal = g_key_file_get_boolean(key_file, "Desktop Entry", "Terminal", NULL);
+    app->workdir = g_key_file_get_string(key_file, "Desktop Entry", "Path", NULL);
+    
+    char *type = g_key_file_get_string(key_file, "Desktop Entry", "Type", NULL);
+    if (type && g_strcmp0(type, "Application") != 0) {
+        app->hidden = TRUE;
+    }
+    g_free(type);
+    
+    g_key_file_free(key_file);
+    return app;
+}
+
+gboolean app_is_visible(const DesktopApp *app) {
+    return app->name && app->exec && !app->no_display && !app->hidden;
+}
+
+char *fold_search_text(const char *text) {
+    if (!text) return NULL;
+    return g_str_is_ascii(text) ? g_strdup(text) : g_utf8_casefold(text, -1);
+}
+
+void index_app(DesktopApp *app) {
+    g_hash_table_replace(app_index, app->id, app);
+    if (!app_is_visible(app)) return;
+    
+    char *keywords = app->keywords ? g_strjoinv(" ", app->keywords) : NULL;
+    char *name = fold_search_text(app->name);
+    char *generic_name = fold_search_text(app->generic_name);
+    char *folded_keywords = fold_search_text(keywords);
+    
+    app->match_item = amatch_add(app_matcher, app, name, generic_name, folded_keywords);
+    amatch_set_boost(app->match_item, launch_boost(app->id));
+    
+    g_free(keywords);
+    g_free(name);
+    g_free(generic_name);
+    g_free(folded_keywords);
+}
+
+void refresh_app(const char *id) {
+    for (guint i = 0; i < app_dirs->len; i++) {
+        char *path = g_build_filename(g_ptr_array_index(app_dirs, i), id, NULL);
+        DesktopApp *app = load_desktop_app(id, path);
+        g_free(path);
+        
+        if (app) {
+            index_app(app);
+            update_apps_menu_entry(id);
+            return;
+        }
+    }
+    
+    g_hash_table_remove(app_index, id);
+    forget_launch(id);
+    update_apps_menu_entry(id);
+}
+
+void on_app_dir_changed(GFileMonitor *monitor, GFile *file, GFile *other_file,
+                        GFileMonitorEvent event_type, gpointer user_data) {
+    switch (event_type) {
+        case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+        case G_FILE_MONITOR_EVENT_CREATED:
+        case G_FILE_MONITOR_EVENT_DELETED:
+        case G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED:
+        case G_FILE_MONITOR_EVENT_MOVED_IN:
+        case G_FILE_MONITOR_EVENT_MOVED_OUT:
+        case G_FILE_MONITOR_EVENT_RENAMED:
+            break;
+        default:
+            return;
+    }
+    
+    GFile *files[] = { file, other_file };
+    for (int i = 0; i < 2; i++) {
+        if (!files[i]) continue;
+        char *id = g_file_get_basename(files[i]);
+        if (g_str_has_suffix(id, ".desktop")) {
+            refresh_app(id);
+        }
+        g_free(id);
+    }
+}
+
+void add_app_dir(const char *data_dir) {
+    char *dir_path = g_build_filename(data_dir, "applications", NULL);
+    
+    for (guint i = 0; i < app_dirs->len; i++) {
+        if (g_strcmp0(g_ptr_array_index(app_dirs, i), dir_path) == 0) {
+            g_free(dir_path);
+            return;
+        }
+    }
+    g_ptr_array_add(app_dirs, dir_path);
+    
+    GDir *dir = g_dir_open(dir_path, 0, NULL);
+    if (dir) {
+        const char *name;
+        while ((name = g_dir_read_name(dir)) != NULL) {
+            if (!g_str_has_suffix(name, ".desktop") || g_hash_table_contains(app_index, name)) continue;
+            
+            char *path = g_build_filename(dir_path, name, NULL);
+            DesktopApp *app = load_desktop_app(name, path);
+            if (app) {
+                index_app(app);
+            }
+            g_free(path);
+        }
+        g_dir_close(dir);
+    }
+    
+    GFile *file = g_file_new_for_path(dir_path);
+    GFileMonitor *monitor = g_file_monitor_directory(file, G_FILE_MONITOR_WATCH_MOVES, NULL, NULL);
+    if (monitor) {
+        g_signal_connect(monitor, "changed", G_CALLBACK(on_app_dir_changed), NULL);
+        app_monitors = g_list_prepend(app_monitors, monitor);
+    }
+    g_object_unref(file);
+}
+
+void build_app_index() {
+    app_dirs = g_ptr_array_new_with_free_func(g_free);
+    app_index = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)free_desktop_app);
+    app_matcher = amatch_new();
+    
+    add_app_dir(g_get_user_data_dir());
+    const char * const *data_dirs = g_get_system_data_dirs();
+    for (int i = 0; data_dirs[i]; i++) {
+        add_app_dir(data_dirs[i]);
+    }
+    prune_history();
+}
+
+void free_app_index() {
+    g_clear_pointer(&apps_menu_items, g_hash_table_destroy);
+    g_list_free(frequent_items);
+    frequent_items = NULL;
+    g_list_free_full(app_monitors, g_object_unref);
+    app_monitors = NULL;
+    g_clear_pointer(&app_index, g_hash_table_destroy);
+    g_clear_pointer(&app_dirs, g_ptr_array_unref);
+    g_clear_pointer(&app_matcher, amatch_free);
+}
+
+gint compare_apps_by_launches(gconstpointer a, gconstpointer b) {
+    const DesktopApp *x = *(const DesktopApp **)a;
+    const DesktopApp *y = *(const DesktopApp **)b;
+    double fx = launch_frecency(x->id);
+    double fy = launch_frecency(y->id);
+    
+    if (fx != fy) return (fx < fy) - (fx > fy);
+    return g_utf8_collate(x->name, y->name);
+}
+
+void update_app_boosts() {
+    GHashTableIter iter;
+    gpointer value;
+    
+    g_hash_table_iter_init(&iter, app_index);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        DesktopApp *app = value;
+        if (app->match_item) {
+            amatch_set_boost(app->match_item, launch_boost(app->id));
+        }
+    }
+}
+
+int app_menu_group(const DesktopApp *app) {
+    for (int i = 0; app->categories && app->categories[i]; i++) {
+        for (guint c = 0; c < G_N_ELEMENTS(app_categories); c++) {
+            if (strcmp(app->categories[i], app_categories[c].category) != 0) continue;
+            
+            for (guint g = 0; g < APP_MENU_GROUPS; g++) {
+                if (strcmp(app_menu_groups[g], app_categories[c].label) == 0) return g;
+            }
+        }
+    }
+    return APP_MENU_GROUPS - 1;
+}
+
+void free_icon_entry(IconEntry *entry) {
+    g_free(entry->key);
+    g_clear_object(&entry->pixbuf);
+    g_free(entry);
+}
+
+void clear_icon_cache() {
+    /* Icons already shown keep their own references. */
+    g_queue_clear(&icon_lru);
+    g_hash_table_remove_all(icon_cache);
+}
+
+gint compare_icon_files(gconstpointer a, gconstpointer b) {
+    const char *const *x = a;
+    const char *const *y = b;
+    
+    /* Sorted newest first by the mtime packed in front of the name. */
+    return strcmp(*y, *x);
+}
+
+gpointer prune_icon_disk_cache(gpointer data) {
+    char *dir_path = data;
+    GDir *dir = g_dir_open(dir_path, 0, NULL);
+    gint64 cutoff = g_get_real_time() / G_USEC_PER_SEC - ICON_DISK_CACHE_DAYS * 24 * 60 * 60;
+    GPtrArray *files = g_ptr_array_new_with_free_func(g_free);
+    const char *name;
+    
+    /* Hits refresh a file's mtime, so what goes is what no session has
+       shown for a while: icons of removed apps or an old theme. */
+    while (dir && (name = g_dir_read_name(dir))) {
+        char *path = g_build_filename(dir_path, name, NULL);
+        GStatBuf st;
+        if (g_stat(path, &st) == 0 && st.st_mtime >= cutoff) {
+            g_ptr_array_add(files, g_strdup_printf("%020" G_GINT64_FORMAT " %s", (gint64)st.st_mtime, name));
+        } else {
+            g_unlink(path);
+        }
+        g_free(path);
+    }
+    
+    g_ptr_array_sort(files, compare_icon_files);
+    for (guint i = ICON_DISK_CACHE_FILES; i < files->len; i++) {
+        char *path = g_build_filename(dir_path, strchr(g_ptr_array_index(files, i), ' ') + 1, NULL);
+        g_unlink(path);
+        g_free(path);
+    }
+    
+    g_ptr_array_free(files, TRUE);
+    if (dir) {
+        g_dir_close(dir);
+    }
+    g_free(dir_path);
+    return NULL;
+}
+
+void load_icon_job(gpointer data, gpointer user_data);
+
+void init_icon_loader() {
+    icon_cache = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)free_icon_entry);
+    icon_waiters = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_ptr_array_unref);
+    icon_cache_dir = g_build_filename(g_get_user_cache_dir(), ICON_CACHE_DIR, NULL);
+    icon_loader = g_thread_pool_new(load_icon_job, NULL, ICON_LOADER_THREADS, FALSE, NULL);
+    g_signal_connect(gtk_icon_theme_get_default(), "changed", G_CALLBACK(clear_icon_cache), NULL);
+    g_thread_unref(g_thread_new("icon-prune", prune_icon_disk_cache, g_strdup(icon_cache_dir)));
+}
+
+gboolean on_icon_loaded(gpointer data);
+
+void load_icon_job(gpointer data, gpointer user_data) {
+    IconJob *job = data;
+    GStatBuf st;
+    char *cache_path = NULL;
+    
+    /* Scaled copies are cached on disk under the source path, mtime and
+       size, so an updated icon never hits a stale copy. */
+    if (g_stat(job->path, &st) == 0) {
+        char *source = g_strdup_printf("%s\n%" G_GINT64_FORMAT "\n%d", job->path, (gint64)st.st_mtime, job->size);
+        char *digest = g_compute_checksum_for_string(G_CHECKSUM_SHA1, source, -1);
+        char *name = g_strconcat(digest, ".png", NULL);
+        cache_path = g_build_filename(icon_cache_dir, name, NULL);
+        job->pixbuf = gdk_pixbuf_new_from_file(cache_path, NULL);
+        if (job->pixbuf) {
+            utime(cache_path, NULL);
+        }
+        g_free(name);
+        g_free(digest);
+        g_free(source);
+    }
+    
+    if (!job->pixbuf) {
+        job->pixbuf = gdk_pixbuf_new_from_file_at_scale(job->path, job->size, job->size, TRUE, NULL);
+        if (job->pixbuf && cache_path) {
+            char *tmp_path = g_strconcat(cache_path, ".tmp", NULL);
+            g_mkdir_with_parents(icon_cache_dir, 0755);
+            if (gdk_pixbuf_save(job->pixbuf, tmp_path, "png", NULL, NULL)) {
+                g_rename(tmp_path, cache_path);
+            } else {
+                g_unlink(tmp_path);
+            }
+            g_free(tmp_path);
+        }
+    }
+    g_free(cache_path);
+    g_idle_add(on_icon_loaded, job);
+}
+
+void cache_icon(const char *key, GdkPixbuf *pixbuf) {
+    IconEntry *old = g_hash_table_lookup(icon_cache, key);
+    if (old) {
+        g_queue_remove(&icon_lru, old);
+    }
+    
+    IconEntry *entry = g_new0(IconEntry, 1);
+    entry->key = g_strdup(key);
+    entry->pixbuf = pixbuf ? g_object_ref(pixbuf) : NULL;
+    g_hash_table_replace(icon_cache, entry->key, entry);
+    g_queue_push_head(&icon_lru, entry);
+    
+    while (icon_lru.length > ICON_CACHE_SIZE) {
+        IconEntry *oldest = g_queue_pop_tail(&icon_lru);
+        g_hash_table_remove(icon_cache, oldest->key);
+    }
+}
+
+gboolean on_icon_loaded(gpointer data) {
+    IconJob *job = data;
+    GPtrArray *images = g_hash_table_lookup(icon_waiters, job->key);
+    
+    /* Failures are cached too, so a missing icon is looked for once. */
+    cache_icon(job->key, job->pixbuf);
+    for (guint i = 0; images && job->pixbuf && i < images->len; i++) {
+        GtkWidget *waiter = g_ptr_array_index(images, i);
+        if (GTK_IS_IMAGE(waiter)) {
+            gtk_image_set_from_pixbuf(GTK_IMAGE(waiter), job->pixbuf);
+        } else {
+            gtk_widget_queue_draw(waiter);
+        }
+    }
+    g_hash_table_remove(icon_waiters, job->key);
+    
+    g_clear_object(&job->pixbuf);
+    g_free(job->key);
+    g_free(job->path);
+    g_free(job);
+    return G_SOURCE_REMOVE;
+}
+
+char *find_icon_path(const char *icon, int size) {
+    if (g_path_is_absolute(icon)) {
+        return g_strdup(icon);
+    }
+    
+    GtkIconInfo *info = gtk_icon_theme_lookup_icon(gtk_icon_theme_get_default(), icon, size,
+                                                   GTK_ICON_LOOKUP_FORCE_SIZE);
+    if (!info) return NULL;
+    char *path = g_strdup(gtk_icon_info_get_filename(info));
+    g_object_unref(info);
+    return path;
+}
+
+/* Returns the cached icon, or NULL and starts loading it; waiter is then
+   an image to fill in or a widget to redraw once the icon arrives. */
+GdkPixbuf *get_app_icon(const DesktopApp *app, int size, GtkWidget *waiter) {
+    if (!app->icon || !*app->icon) return NULL;
+    if (!icon_loader) {
+        init_icon_loader();
+    }
+    
+    char *key = g_strdup_printf("%d:%s", size, app->icon);
+    IconEntry *entry = g_hash_table_lookup(icon_cache, key);
+    if (entry) {
+        g_queue_remove(&icon_lru, entry);
+        g_queue_push_head(&icon_lru, entry);
+        g_free(key);
+        return entry->pixbuf;
+    }
+    
+    /* The text is shown right away; the icon fills in once a loader
+       thread has decoded and scaled it. */
+    GPtrArray *images = g_hash_table_lookup(icon_waiters, key);
+    if (!images) {
+        char *path = find_icon_path(app->icon, size);
+        if (!path) {
+            cache_icon(key, NULL);
+            g_free(key);
+            return NULL;
+        }
+        
+        images = g_ptr_array_new_with_free_func(g_object_unref);
+        g_hash_table_insert(icon_waiters, g_strdup(key), images);
+        
+        IconJob *job = g_new0(IconJob, 1);
+        job->key = g_strdup(key);
+        job->path = path;
+        job->size = size;
+        g_thread_pool_push(icon_loader, job, NULL);
+    }
+    if (!g_ptr_array_find(images, waiter, NULL)) {
+        g_ptr_array_add(images, g_object_ref(waiter));
+    }
+    g_free(key);
+    return NULL;
+}
+
+void set_app_icon(GtkWidget *image, const DesktopApp *app, int size) {
+    GdkPixbuf *pixbuf = get_app_icon(app, size, image);
+    if (pixbuf) {
+        gtk_image_set_from_pixbuf(GTK_IMAGE(image), pixbuf);
+    }
+}
+
+void free_icon_loader() {
+    if (!icon_loader) return;
+    
+    g_thread_pool_free(icon_loader, TRUE, TRUE);
+    icon_loader = NULL;
+    g_queue_clear(&icon_lru);
+    g_clear_pointer(&icon_cache, g_hash_table_destroy);
+    g_clear_pointer(&icon_waiters, g_hash_table_destroy);
+    g_clear_pointer(&icon_cache_dir, g_free);
+}
+
+void on_app_item_mapped(GtkWidget *item, gpointer data) {
+    DesktopApp *app = g_hash_table_lookup(app_index, (const char *)data);
+    
+    /* Icons for the whole Apps menu are only loaded as submenus open. */
+    if (app) {
+        set_app_icon(g_object_get_data(G_OBJECT(item), "image"), app, ICON_MENU_SIZE);
+    }
+    g_signal_handlers_disconnect_by_func(item, on_app_item_mapped, data);
+}
+
+GtkWidget *create_app_menu_item(const DesktopApp *app) {
+    GtkWidget *item = gtk_menu_item_new();
+    GtkWidget *box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 6);
+    GtkWidget *image = gtk_image_new();
+    GtkWidget *label = gtk_label_new(app->name);
+    
+    gtk_widget_set_size_request(image, ICON_MENU_SIZE, ICON_MENU_SIZE);
+    gtk_widget_set_halign(label, GTK_ALIGN_START);
+    gtk_box_pack_start(GTK_BOX(box), image, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(box), label, TRUE, TRUE, 0);
+    gtk_container_add(GTK_CONTAINER(item), box);
+    gtk_widget_show_all(box);
+    
+    g_object_set_data(G_OBJECT(item), "image", image);
+    g_object_set_data_full(G_OBJECT(item), "name", g_strdup(app->name), g_free);
+    if (app->icon) {
+        g_signal_connect_data(item, "map", G_CALLBACK(on_app_item_mapped), g_strdup(app->id),
+                              (GClosureNotify)g_free, 0);
+    }
+    g_signal_connect_data(item, "activate", G_CALLBACK(launch_app), g_strdup(app->id),
+                          (GClosureNotify)g_free, 0);
+    gtk_widget_show(item);
+    return item;
+}
+
+void add_apps_menu_entry(DesktopApp *app, gboolean in_order) {
+    GtkWidget *group_item = group_items[app_menu_group(app)];
+    GtkWidget *submenu = gtk_menu_item_get_submenu(GTK_MENU_ITEM(group_item));
+    GtkWidget *item = create_app_menu_item(app);
+    int position = -1;
+    
+    if (!in_order) {
+        GList *children = gtk_container_get_children(GTK_CONTAINER(submenu));
+        position = 0;
+        for (GList *iter = children; iter; iter = iter->next, position++) {
+            if (g_utf8_collate(app->name, g_object_get_data(G_OBJECT(iter->data), "name")) < 0) break;
+        }
+        g_list_free(children);
+    }
+    
+    gtk_menu_shell_insert(GTK_MENU_SHELL(submenu), item, position);
+    gtk_widget_show(group_item);
+    g_hash_table_insert(apps_menu_items, g_strdup(app->id), item);
+}
+
+gint compare_apps_by_name(gconstpointer a, gconstpointer b) {
+    const DesktopApp *x = *(const DesktopApp **)a;
+    const DesktopApp *y = *(const DesktopApp **)b;
+    return g_utf8_collate(x->name, y->name);
+}
+
+void update_apps_menu_entry(const char *id) {
+    if (!apps_menu) return;
+    
+    GtkWidget *item = g_hash_table_lookup(apps_menu_items, id);
+    if (item) {
+        GtkWidget *submenu = gtk_widget_get_parent(item);
+        g_hash_table_remove(apps_menu_items, id);
+        gtk_widget_destroy(item);
+        
+        GList *children = gtk_container_get_children(GTK_CONTAINER(submenu));
+        if (!children) {
+            gtk_widget_hide(gtk_menu_get_attach_widget(GTK_MENU(submenu)));
+        }
+        g_list_free(children);
+    }
+    
+    DesktopApp *app = g_hash_table_lookup(app_index, id);
+    if (app && app_is_visible(app)) {
+        add_apps_menu_entry(app, FALSE);
+    }
+}
+
+void update_frequent_apps() {
+    g_list_free_full(frequent_items, (GDestroyNotify)gtk_widget_destroy);
+    frequent_items = NULL;
+    
+    GPtrArray *apps = g_ptr_array_new();
+    GHashTableIter iter;
+    gpointer value;
+    
+    g_hash_table_iter_init(&iter, app_index);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        DesktopApp *app = value;
+        if (app_is_visible(app) && launch_frecency(app->id) >= HISTORY_MIN_SCORE) {
+            g_ptr_array_add(apps, app);
+        }
+    }
+    g_ptr_array_sort(apps, compare_apps_by_launches);
+    
+    for (guint i = 0; i < apps->len && i < APPS_MENU_FREQUENT; i++) {
+        GtkWidget *item = create_app_menu_item(g_ptr_array_index(apps, i));
+        gtk_menu_shell_insert(GTK_MENU_SHELL(apps_menu), item, i);
+        frequent_items = g_list_prepend(frequent_items, item);
+    }
+    gtk_widget_set_visible(apps_menu_separator, frequent_items != NULL);
+    g_ptr_array_free(apps, TRUE);
+    
+    apps_menu_history_serial = history_serial;
+}
+
+GtkWidget *get_apps_menu() {
+    if (apps_menu) {
+        if (apps_menu_history_serial != history_serial) {
+            update_frequent_apps();
+        }
+        return apps_menu;
+    }
+    
+    /* Built once from the index, then patched by update_apps_menu_entry(). */
+    apps_menu = gtk_menu_new();
+    apps_menu_items = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    
+    apps_menu_separator = gtk_separator_menu_item_new();
+    gtk_menu_shell_append(GTK_MENU_SHELL(apps_menu), apps_menu_separator);
+    
+    for (guint g = 0; g < APP_MENU_GROUPS; g++) {
+        group_items[g] = gtk_menu_item_new_with_label(app_menu_groups[g]);
+        gtk_menu_item_set_submenu(GTK_MENU_ITEM(group_items[g]), gtk_menu_new());
+        gtk_menu_shell_append(GTK_MENU_SHELL(apps_menu), group_items[g]);
+    }
+    
+    /* Sorted once up front, so each item is simply appended to its group. */
+    GPtrArray *apps = g_ptr_array_new();
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, app_index);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        if (app_is_visible(value)) {
+            g_ptr_array_add(apps, value);
+        }
+    }
+    g_ptr_array_sort(apps, compare_apps_by_name);
+    for (guint i = 0; i < apps->len; i++) {
+        add_apps_menu_entry(g_ptr_array_index(apps, i), TRUE);
+    }
+    g_ptr_array_free(apps, TRUE);
+    
+    update_frequent_apps();
+    return apps_menu;
 }
 
-void paste_text(GtkWidget *widget, gpointer data) {
-    int current_page = gtk_notebook_get_current_page(GTK_NOTEBOOK(notebook));
-    vte_terminal_paste_clipboard(VTE_TERMINAL(terminal_tabs[current_page]));
+void update_amenu_list(const char *text) {
+    gint64 trace = trace_begin();
+    GtkTreeModel *model = GTK_TREE_MODEL(amenu_store);
+    const AMatchResult *results = NULL;
+    size_t n_results = 0;
+    
+    if (*text) {
+        char *query = fold_search_text(text);
+        results = amatch_query(app_matcher, query, &n_results);
+        g_free(query);
+    }
+    
+    /* Rows are rewritten in place and only the tail is added or removed,
+       so the view keeps its rows and only redraws the ones that changed. */
+    GtkTreeIter iter;
+    gboolean valid = gtk_tree_model_get_iter_first(model, &iter);
+    for (size_t i = 0; i < n_results; i++) {
+        DesktopApp *app = results[i].data;
+        if (valid) {
+            char *id;
+            gtk_tree_model_get(model, &iter, AMENU_COL_ID, &id, -1);
+            gboolean same = g_strcmp0(id, app->id) == 0;
+            g_free(id);
+            if (same) {
+                valid = gtk_tree_model_iter_next(model, &iter);
+                continue;
+            }
+        } else {
+            gtk_list_store_append(amenu_store, &iter);
+        }
+        gtk_list_store_set(amenu_store, &iter, AMENU_COL_ID, app->id, AMENU_COL_NAME, app->name, -1);
+        valid = gtk_tree_model_iter_next(model, &iter);
+    }
+    while (valid) {
+        valid = gtk_list_store_remove(amenu_store, &iter);
+    }
+    
+    if (n_results > 0) {
+        GtkTreePath *path = gtk_tree_path_new_first();
+        gtk_tree_selection_select_path(gtk_tree_view_get_selection(GTK_TREE_VIEW(amenu_view)), path);
+        gtk_tree_view_scroll_to_cell(GTK_TREE_VIEW(amenu_view), path, NULL, FALSE, 0, 0);
+        gtk_tree_path_free(path);
+    }
+    trace_end("update_amenu_list", trace);
 }
 
-void launch_app(GtkWidget *widget, gpointer data) {
-    const char *command = (const char *)data;
-    char *argv[] = { (char *)command, NULL };
-    g_spawn_async(NULL, argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL, NULL, NULL);
+void on_amenu_changed(GtkEditable *editable, gpointer user_data) {
+    update_amenu_list(gtk_entry_get_text(GTK_ENTRY(editable)));
 }
 
-void launch_obconf(GtkWidget *widget, gpointer data) {
-    char *argv[] = { "obconf", NULL };
-    g_spawn_async(NULL, argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL, NULL, NULL);
+void set_amenu_icon(GtkTreeViewColumn *column, GtkCellRenderer *cell, GtkTreeModel *model,
+                    GtkTreeIter *iter, gpointer data) {
+    char *id;
+    gtk_tree_model_get(model, iter, AMENU_COL_ID, &id, -1);
+    DesktopApp *app = g_hash_table_lookup(app_index, id);
+    
+    /* Only called for rows being drawn, so icons load as results scroll in. */
+    g_object_set(cell, "pixbuf", app ? get_app_icon(app, ICON_AMENU_SIZE, amenu_view) : NULL, NULL);
+    g_free(id);
 }
 
-GtkWidget *create_apps_menu() {
-    GtkWidget *menu = gtk_menu_new();
-    DIR *dir;
-    struct dirent *ent;
-    const char *applications_dir = "/usr/share/applications/";
-    
-    if ((dir = opendir(applications_dir)) != NULL) {
-        while ((ent = readdir(dir)) != NULL) {
-            if (g_str_has_suffix(ent->d_name, ".desktop")) {
-                char *path = g_build_filename(applications_dir, ent->d_name, NULL);
-                GKeyFile *key_file = g_key_file_new();
-                if (g_key_file_load_from_file(key_file, path, G_KEY_FILE_NONE, NULL)) {
-                    char *name = g_key_file_get_string(key_file, "Desktop Entry", "Name", NULL);
-                    char *exec = g_key_file_get_string(key_file, "Desktop Entry", "Exec", NULL);
-                    
-                    if (name && exec) {
-                        GtkWidget *item = gtk_menu_item_new_with_label(name);
-                        g_signal_connect(item, "activate", G_CALLBACK(launch_app), g_strdup(exec));
-                        gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
-                    }
-                    
-                    g_free(name);
-                    g_free(exec);
-                }
-                g_key_file_free(key_file);
-                g_free(path);
-            }
-        }
-        closedir(dir);
+void launch_amenu_row(GtkTreeIter *iter) {
+    char *id;
+    gtk_tree_model_get(GTK_TREE_MODEL(amenu_store), iter, AMENU_COL_ID, &id, -1);
+    gtk_widget_hide(amenu_window);
+    launch_app(NULL, id);
+    g_free(id);
+}
+
+void on_amenu_row_activated(GtkTreeView *view, GtkTreePath *path, GtkTreeViewColumn *column,
+                            gpointer user_data) {
+    GtkTreeIter iter;
+    if (gtk_tree_model_get_iter(GTK_TREE_MODEL(amenu_store), &iter, path)) {
+        launch_amenu_row(&iter);
+    }
+}
+
+void move_amenu_selection(int delta) {
+    GtkTreeSelection *selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(amenu_view));
+    GtkTreeModel *model = GTK_TREE_MODEL(amenu_store);
+    GtkTreeIter iter;
+    int count = gtk_tree_model_iter_n_children(model, NULL);
+    int row = 0;
+    if (count == 0) return;
+    
+    if (gtk_tree_selection_get_selected(selection, NULL, &iter)) {
+        GtkTreePath *path = gtk_tree_model_get_path(model, &iter);
+        row = gtk_tree_path_get_indices(path)[0] + delta;
+        gtk_tree_path_free(path);
     }
+    row = CLAMP(row, 0, count - 1);
     
-    return menu;
+    GtkTreePath *path = gtk_tree_path_new_from_indices(row, -1);
+    gtk_tree_selection_select_path(selection, path);
+    gtk_tree_view_scroll_to_cell(GTK_TREE_VIEW(amenu_view), path, NULL, FALSE, 0, 0);
+    gtk_tree_path_free(path);
 }
 
-void update_amenu_list(const char *text) {
-    GList *children, *iter;
-    children = gtk_container_get_children(GTK_CONTAINER(amenu_list));
-    for(iter = children; iter != NULL; iter = g_list_next(iter))
-        gtk_widget_destroy(GTK_WIDGET(iter->data));
-    g_list_free(children);
-    
-    if (strlen(text) == 0) return;
-    
-    DIR *dir;
-    struct dirent *ent;
-    const char *applications_dir = "/usr/share/applications/";
-    int count = 0;
-    
-    if ((dir = opendir(applications_dir)) != NULL) {
-        while ((ent = readdir(dir)) != NULL && count < 10) {
-            if (g_str_has_suffix(ent->d_name, ".desktop")) {
-                char *path = g_build_filename(applications_dir, ent->d_name, NULL);
-                GKeyFile *key_file = g_key_file_new();
-                if (g_key_file_load_from_file(key_file, path, G_KEY_FILE_NONE, NULL)) {
-                    char *name = g_key_file_get_string(key_file, "Desktop Entry", "Name", NULL);
-                    char *exec = g_key_file_get_string(key_file, "Desktop Entry", "Exec", NULL);
-                    
-                    if (name && exec && g_strrstr(name, text)) {
-                        GtkWidget *item = gtk_button_new_with_label(name);
-                        g_signal_connect(item, "clicked", G_CALLBACK(launch_app), g_strdup(exec));
-                        gtk_container_add(GTK_CONTAINER(amenu_list), item);
-                        count++;
-                    }
-                    
-                    g_free(name);
-                    g_free(exec);
-                }
-                g_key_file_free(key_file);
-                g_free(path);
+gboolean on_amenu_key_press(GtkWidget *widget, GdkEventKey *event, gpointer user_data) {
+    GtkTreeIter iter;
+    
+    /* Focus stays in the entry; the arrows move through the results. */
+    switch (event->keyval) {
+        case GDK_KEY_Up:
+        case GDK_KEY_KP_Up:
+            move_amenu_selection(-1);
+            return TRUE;
+        case GDK_KEY_Down:
+        case GDK_KEY_KP_Down:
+            move_amenu_selection(1);
+            return TRUE;
+        case GDK_KEY_Page_Up:
+        case GDK_KEY_KP_Page_Up:
+            move_amenu_selection(-AMENU_PAGE_ROWS);
+            return TRUE;
+        case GDK_KEY_Page_Down:
+        case GDK_KEY_KP_Page_Down:
+            move_amenu_selection(AMENU_PAGE_ROWS);
+            return TRUE;
+        case GDK_KEY_Return:
+        case GDK_KEY_KP_Enter:
+            if (gtk_tree_selection_get_selected(gtk_tree_view_get_selection(GTK_TREE_VIEW(amenu_view)),
+                                                NULL, &iter)) {
+                launch_amenu_row(&iter);
             }
-        }
-        closedir(dir);
+            return TRUE;
+        case GDK_KEY_Escape:
+            gtk_widget_hide(amenu_window);
+            return TRUE;
     }
-    
-    gtk_widget_show_all(amenu_list);
+    return FALSE;
 }
 
 void show_amenu() {
@@ -323,33 +2641,63 @@ void show_amenu() {
         gtk_window_set_default_size(GTK_WINDOW(amenu_window), 400, 300);
         gtk_window_set_position(GTK_WINDOW(amenu_window), GTK_WIN_POS_CENTER);
         gtk_container_set_border_width(GTK_CONTAINER(amenu_window), 10);
+        g_signal_connect(amenu_window, "delete-event", G_CALLBACK(gtk_widget_hide_on_delete), NULL);
         
         GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
         gtk_container_add(GTK_CONTAINER(amenu_window), box);
         
         amenu_entry = gtk_entry_new();
         gtk_entry_set_placeholder_text(GTK_ENTRY(amenu_entry), "Type program name...");
-        g_signal_connect(amenu_entry, "changed", G_CALLBACK(update_amenu_list), NULL);
+        g_signal_connect(amenu_entry, "changed", G_CALLBACK(on_amenu_changed), NULL);
+        g_signal_connect(amenu_entry, "key-press-event", G_CALLBACK(on_amenu_key_press), NULL);
         gtk_box_pack_start(GTK_BOX(box), amenu_entry, FALSE, FALSE, 0);
         
-        amenu_list = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
-        gtk_box_pack_start(GTK_BOX(box), amenu_list, TRUE, TRUE, 0);
+        amenu_store = gtk_list_store_new(AMENU_N_COLS, G_TYPE_STRING, G_TYPE_STRING);
+        amenu_view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(amenu_store));
+        gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(amenu_view), FALSE);
+        gtk_tree_view_set_enable_search(GTK_TREE_VIEW(amenu_view), FALSE);
+        gtk_tree_view_set_activate_on_single_click(GTK_TREE_VIEW(amenu_view), TRUE);
+        gtk_widget_set_can_focus(amenu_view, FALSE);
+        g_signal_connect(amenu_view, "row-activated", G_CALLBACK(on_amenu_row_activated), NULL);
+        
+        /* Every row has the same height, so the view only measures and
+           draws the rows that are on screen, however many results there are. */
+        GtkTreeViewColumn *column = gtk_tree_view_column_new();
+        GtkCellRenderer *icon_cell = gtk_cell_renderer_pixbuf_new();
+        GtkCellRenderer *name_cell = gtk_cell_renderer_text_new();
+        gtk_cell_renderer_set_fixed_size(icon_cell, ICON_AMENU_SIZE, ICON_AMENU_SIZE);
+        gtk_tree_view_column_pack_start(column, icon_cell, FALSE);
+        gtk_tree_view_column_set_cell_data_func(column, icon_cell, set_amenu_icon, NULL, NULL);
+        gtk_tree_view_column_pack_start(column, name_cell, TRUE);
+        gtk_tree_view_column_add_attribute(column, name_cell, "text", AMENU_COL_NAME);
+        gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+        gtk_tree_view_append_column(GTK_TREE_VIEW(amenu_view), column);
+        gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(amenu_view), TRUE);
+        
+        GtkWidget *scrolled = gtk_scrolled_window_new(NULL, NULL);
+        gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+        gtk_container_add(GTK_CONTAINER(scrolled), amenu_view);
+        gtk_box_pack_start(GTK_BOX(box), scrolled, TRUE, TRUE, 0);
         
         g_signal_connect(amenu_window, "key-press-event", G_CALLBACK(on_key_press), NULL);
     }
     
+    update_app_boosts();
     gtk_entry_set_text(GTK_ENTRY(amenu_entry), "");
     gtk_widget_show_all(amenu_window);
     gtk_widget_grab_focus(amenu_entry);
 }
 
-void show_context_menu(GtkWidget *widget) {
+void on_record_toggled(GtkCheckMenuItem *item, gpointer data);
+
+GtkWidget *create_context_menu() {
     GtkWidget *menu = gtk_menu_new();
+    gtk_menu_attach_to_widget(GTK_MENU(menu), window, NULL);
     
     GtkWidget *apps_item = gtk_menu_item_new_with_label("Apps");
-    GtkWidget *apps_menu = create_apps_menu();
-    gtk_menu_item_set_submenu(GTK_MENU_ITEM(apps_item), apps_menu);
+    gtk_menu_item_set_submenu(GTK_MENU_ITEM(apps_item), get_apps_menu());
     gtk_menu_shell_append(GTK_MENU_SHELL(menu), apps_item);
+    gtk_widget_show(apps_item);
     
     GtkWidget *about_item = gtk_menu_item_new_with_label("About");
     g_signal_connect(about_item, "activate", G_CALLBACK(show_about_dialog), NULL);
@@ -367,67 +2715,811 @@ void show_context_menu(GtkWidget *widget) {
     g_signal_connect(paste_item, "activate", G_CALLBACK(paste_text), NULL);
     gtk_menu_shell_append(GTK_MENU_SHELL(menu), paste_item);
     
+    GtkWidget *save_item = gtk_menu_item_new_with_label("Save Scrollback...");
+    g_signal_connect(save_item, "activate", G_CALLBACK(save_scrollback), NULL);
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), save_item);
+    
+    record_item = gtk_check_menu_item_new_with_label("Record Tab");
+    g_signal_connect(record_item, "toggled", G_CALLBACK(on_record_toggled), NULL);
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), record_item);
+    
     GtkWidget *obconf_item = gtk_menu_item_new_with_label("Openbox Config");
     g_signal_connect(obconf_item, "activate", G_CALLBACK(launch_obconf), NULL);
     gtk_menu_shell_append(GTK_MENU_SHELL(menu), obconf_item);
     
-    gtk_widget_show_all(menu);
+    gtk_widget_show(about_item);
+    gtk_widget_show(help_item);
+    gtk_widget_show(copy_item);
+    gtk_widget_show(paste_item);
+    gtk_widget_show(save_item);
+    gtk_widget_show(record_item);
+    gtk_widget_show(obconf_item);
+    
+    return menu;
+}
+
+void show_context_menu(GtkWidget *widget) {
+    gint64 trace = trace_begin();
+    if (!context_menu) {
+        context_menu = create_context_menu();
+    } else {
+        get_apps_menu();
+    }
+    
+    Tab *tab = tab_at(gtk_notebook_get_current_page(GTK_NOTEBOOK(notebook)));
+    g_signal_handlers_block_by_func(record_item, on_record_toggled, NULL);
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(record_item), tab && tab->recording);
+    g_signal_handlers_unblock_by_func(record_item, on_record_toggled, NULL);
     
     GdkEvent *event = gtk_get_current_event();
     if (event) {
-        gtk_menu_popup_at_pointer(GTK_MENU(menu), event);
+        gtk_menu_popup_at_pointer(GTK_MENU(context_menu), event);
         gdk_event_free(event);
     } else {
-        gtk_menu_popup_at_widget(GTK_MENU(menu), widget, GDK_GRAVITY_CENTER, GDK_GRAVITY_CENTER, NULL);
+        gtk_menu_popup_at_widget(GTK_MENU(context_menu), widget, GDK_GRAVITY_CENTER, GDK_GRAVITY_CENTER, NULL);
+    }
+    trace_end("show_context_menu", trace);
+}
+
+gboolean on_button_press(GtkWidget *widget, GdkEventButton *event, gpointer user_data) {
+    if (event->button == GDK_BUTTON_SECONDARY) {
+        show_context_menu(widget);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+GtkWidget *create_header_bar() {
+    GtkWidget *header = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+    gtk_widget_set_size_request(header, -1, 32);
+    
+    GtkCssProvider *css_provider = gtk_css_provider_new();
+    gtk_css_provider_load_from_data(css_provider,
+        "box {"
+        "  background: #000033;"
+        "  border-bottom: 2px solid #00FFFF;"
+        "  color: #00FFFF;"
+        "  padding: 0 12px;"
+        "  font-family: 'Courier New', monospace;"
+        "  font-weight: bold;"
+        "}", -1, NULL);
+    gtk_style_context_add_provider(gtk_widget_get_style_context(header),
+                                  GTK_STYLE_PROVIDER(css_provider),
+                                  GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
+    
+    tab_info_label = gtk_label_new("ATermD - 1/10 | ALT+1..0");
+    gtk_widget_set_halign(tab_info_label, GTK_ALIGN_START);
+    gtk_widget_set_valign(tab_info_label, GTK_ALIGN_CENTER);
+    
+    status_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 16);
+    gtk_widget_set_halign(status_box, GTK_ALIGN_END);
+    build_status_modules();
+    
+    transfer_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 6);
+    gtk_widget_set_valign(transfer_box, GTK_ALIGN_CENTER);
+    gtk_widget_set_no_show_all(transfer_box, TRUE);
+    transfer_progress = gtk_progress_bar_new();
+    gtk_progress_bar_set_show_text(GTK_PROGRESS_BAR(transfer_progress), TRUE);
+    GtkWidget *cancel_button = gtk_button_new_with_label("Cancel");
+    g_signal_connect(cancel_button, "clicked", G_CALLBACK(on_transfer_cancel), NULL);
+    gtk_box_pack_start(GTK_BOX(transfer_box), transfer_progress, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(transfer_box), cancel_button, FALSE, FALSE, 0);
+    gtk_widget_show(transfer_progress);
+    gtk_widget_show(cancel_button);
+    
+    gtk_box_pack_start(GTK_BOX(header), tab_info_label, FALSE, FALSE, 0);
+    gtk_box_pack_end(GTK_BOX(header), status_box, FALSE, FALSE, 0);
+    gtk_box_pack_end(GTK_BOX(header), transfer_box, FALSE, FALSE, 12);
+    
+    return header;
+}
+
+void on_child_exited(VteTerminal *terminal, int status, gpointer user_data);
+Tab *add_tab();
+void switch_to_tab(int tab_num);
+void apply_scrollback_policy();
+void on_spill_contents_changed(VteTerminal *terminal, gpointer user_data);
+
+Tab *tab_at(int tab_num) {
+    if (tab_num < 0 || tab_num >= (int)tabs->len) return NULL;
+    return g_ptr_array_index(tabs, tab_num);
+}
+
+void watch_tab_activity(Tab *tab, gboolean watch) {
+    if (tab->activity_watched == watch) return;
+    
+    tab->activity_watched = watch;
+    if (watch) {
+        g_signal_handler_unblock(tab->terminal, tab->activity_handler);
+    } else {
+        g_signal_handler_block(tab->terminal, tab->activity_handler);
+    }
+}
+
+void on_tab_contents_changed(VteTerminal *terminal, gpointer user_data) {
+    Tab *tab = g_object_get_data(G_OBJECT(terminal), "tab");
+    if (!tab) return;
+    
+    /* One change is enough to flag the tab, so the handler stays blocked
+       until the tab has been looked at again. */
+    watch_tab_activity(tab, FALSE);
+    if (tab->last_viewed) {
+        tab->activity = TRUE;
+        update_tab_info();
+    }
+}
+
+void on_tab_bell(VteTerminal *terminal, gpointer user_data) {
+    Tab *tab = g_object_get_data(G_OBJECT(terminal), "tab");
+    if (tab && !tab->foreground) {
+        tab->bell = TRUE;
+        update_tab_info();
+    }
+}
+
+void set_tab_foreground(Tab *tab, gboolean foreground) {
+    if (!tab->terminal || tab->foreground == foreground) return;
+    
+    /* VTE already stops painting a terminal whose notebook page is
+       unmapped; hidden tabs also drop the cursor blink timer. */
+    VteTerminal *terminal = VTE_TERMINAL(tab->terminal);
+    tab->foreground = foreground;
+    vte_terminal_set_cursor_blink_mode(terminal, foreground ? VTE_CURSOR_BLINK_SYSTEM : VTE_CURSOR_BLINK_OFF);
+    if (foreground) {
+        tab->activity = FALSE;
+        tab->bell = FALSE;
+    }
+    watch_tab_activity(tab, !foreground);
+}
+
+void ring_copy_in(gsize pos, const void *src, gsize length) {
+    gsize at = pos & (RECORD_RING_SIZE - 1);
+    gsize first = MIN(length, RECORD_RING_SIZE - at);
+    memcpy(record_ring + at, src, first);
+    memcpy(record_ring, (const char *)src + first, length - first);
+}
+
+void ring_copy_out(gsize pos, void *dest, gsize length) {
+    gsize at = pos & (RECORD_RING_SIZE - 1);
+    gsize first = MIN(length, RECORD_RING_SIZE - at);
+    memcpy(dest, record_ring + at, first);
+    memcpy((char *)dest + first, record_ring, length - first);
+}
+
+gboolean push_record(guint id, RecordKind kind, const char *data, gsize length) {
+    RecordHeader header = { id, kind, g_get_monotonic_time(), length };
+    gsize head = atomic_load_explicit(&record_head, memory_order_relaxed);
+    gsize tail = atomic_load_explicit(&record_tail, memory_order_acquire);
+    
+    /* The main thread never waits for the writer; when the ring is full
+       the event is dropped and counted instead. */
+    if (sizeof(header) + length > RECORD_RING_SIZE - (head - tail)) return FALSE;
+    
+    ring_copy_in(head, &header, sizeof(header));
+    ring_copy_in(head + sizeof(header), data, length);
+    atomic_store_explicit(&record_head, head + sizeof(header) + length, memory_order_release);
+    return TRUE;
+}
+
+void queue_record_control(guint id, RecordKind kind, const char *data) {
+    RecordControl *control = g_new0(RecordControl, 1);
+    control->header = (RecordHeader){ id, kind, g_get_monotonic_time(), strlen(data) };
+    /* The writer handles it once it has drained the ring up to here. */
+    control->pos = atomic_load_explicit(&record_head, memory_order_relaxed);
+    control->data = g_strdup(data);
+    
+    g_mutex_lock(&record_lock);
+    g_queue_push_tail(&record_controls, control);
+    g_cond_signal(&record_wake);
+    g_mutex_unlock(&record_lock);
+}
+
+void free_record_control(RecordControl *control) {
+    g_free(control->data);
+    g_free(control);
+}
+
+void append_json_string(GString *json, const char *text, gsize length, gboolean crlf) {
+    for (gsize i = 0; i < length; i++) {
+        unsigned char c = text[i];
+        if (c == '"' || c == '\\') {
+            g_string_append_c(json, '\\');
+            g_string_append_c(json, c);
+        } else if (c == '\n') {
+            g_string_append(json, crlf ? "\\r\\n" : "\\n");
+        } else if (c == '\r') {
+            g_string_append(json, "\\r");
+        } else if (c == '\t') {
+            g_string_append(json, "\\t");
+        } else if (c < 0x20 || c == 0x7f) {
+            g_string_append_printf(json, "\\u%04x", c);
+        } else {
+            g_string_append_c(json, c);
+        }
+    }
+}
+
+void close_record_part(RecordFile *file) {
+    if (file->stream) {
+        g_output_stream_close(file->stream, NULL, NULL);
+    }
+    g_clear_object(&file->stream);
+    g_clear_object(&file->out);
+}
+
+void open_record_part(RecordFile *file, gint64 time) {
+    char *path = file->part ? g_strdup_printf("%s.%d.cast%s", file->base, file->part, file->compress ? ".gz" : "")
+                            : g_strdup_printf("%s.cast%s", file->base, file->compress ? ".gz" : "");
+    char *dir = g_path_get_dirname(path);
+    GFile *gfile = g_file_new_for_path(path);
+    GError *error = NULL;
+    
+    g_mkdir_with_parents(dir, 0700);
+    file->out = g_file_replace(gfile, NULL, FALSE, G_FILE_CREATE_PRIVATE, NULL, &error);
+    if (file->out) {
+        if (file->compress) {
+            GZlibCompressor *compressor = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+            file->stream = g_converter_output_stream_new(G_OUTPUT_STREAM(file->out), G_CONVERTER(compressor));
+            g_object_unref(compressor);
+        } else {
+            file->stream = g_object_ref(G_OUTPUT_STREAM(file->out));
+        }
+        
+        /* Every part starts with its own header, so each plays on its own. */
+        const char *shell = g_getenv("SHELL");
+        file->part_start = time;
+        g_string_append_printf(file->pending, "{\"version\": 2, \"width\": %d, \"height\": %d, "
+                               "\"timestamp\": %" G_GINT64_FORMAT ", \"env\": {\"SHELL\": \"",
+                               file->width, file->height, g_get_real_time() / G_USEC_PER_SEC);
+        append_json_string(file->pending, shell ? shell : "", shell ? strlen(shell) : 0, FALSE);
+        g_string_append(file->pending, "\", \"TERM\": \"xterm-256color\"}}\n");
+    } else {
+        g_warning("Failed to record to %s: %s", path, error->message);
+        g_error_free(error);
+    }
+    
+    g_object_unref(gfile);
+    g_free(dir);
+    g_free(path);
+}
+
+void write_record_file(RecordFile *file) {
+    if (!file->stream || file->pending->len == 0) {
+        g_string_truncate(file->pending, 0);
+        return;
+    }
+    
+    GError *error = NULL;
+    if (!g_output_stream_write_all(file->stream, file->pending->str, file->pending->len, NULL, NULL, &error) ||
+        !g_output_stream_flush(file->stream, NULL, &error)) {
+        g_warning("Failed to write recording %s: %s", file->base, error->message);
+        g_error_free(error);
+        close_record_part(file);
+    } else if (file->rotate_bytes > 0 && g_seekable_tell(G_SEEKABLE(file->out)) >= file->rotate_bytes) {
+        close_record_part(file);
+        file->part++;
+        open_record_part(file, g_get_monotonic_time());
+    }
+    g_string_truncate(file->pending, 0);
+}
+
+void free_record_file(RecordFile *file) {
+    write_record_file(file);
+    close_record_part(file);
+    g_string_free(file->pending, TRUE);
+    g_free(file->base);
+    g_free(file);
+}
+
+void handle_record(GHashTable *files, const RecordHeader *header, const char *data) {
+    RecordFile *file = g_hash_table_lookup(files, GUINT_TO_POINTER(header->id));
+    int compress, rotate_mb, offset = 0;
+    
+    if (header->kind == RECORD_START) {
+        file = g_new0(RecordFile, 1);
+        if (sscanf(data, "%d %d %d %d %n", &compress, &rotate_mb, &file->width, &file->height, &offset) < 4 ||
+            !data[offset]) {
+            g_free(file);
+            return;
+        }
+        file->base = g_strdup(data + offset);
+        file->compress = compress;
+        file->rotate_bytes = (gint64)rotate_mb * 1024 * 1024;
+        file->pending = g_string_new(NULL);
+        open_record_part(file, header->time);
+        g_hash_table_replace(files, GUINT_TO_POINTER(header->id), file);
+        return;
+    }
+    if (!file) return;
+    
+    if (header->kind == RECORD_STOP) {
+        g_hash_table_remove(files, GUINT_TO_POINTER(header->id));
+        return;
+    }
+    
+    const char *code = header->kind == RECORD_OUTPUT ? "o" : header->kind == RECORD_INPUT ? "i" : "m";
+    g_string_append_printf(file->pending, "[%.6f, \"%s\", \"",
+                           MAX(header->time - file->part_start, 0) / (double)G_USEC_PER_SEC, code);
+    append_json_string(file->pending, data, header->length, header->kind == RECORD_OUTPUT);
+    g_string_append(file->pending, "\"]\n");
+}
+
+void handle_record_controls(GHashTable *files, GQueue *controls, gsize pos) {
+    RecordControl *control;
+    while ((control = g_queue_peek_head(controls)) && control->pos <= pos) {
+        g_queue_pop_head(controls);
+        handle_record(files, &control->header, control->data);
+        free_record_control(control);
+    }
+}
+
+void drain_records(GHashTable *files) {
+    gsize tail = atomic_load_explicit(&record_tail, memory_order_relaxed);
+    gsize head = atomic_load_explicit(&record_head, memory_order_acquire);
+    
+    /* Taken after head; whatever was queued since belongs past head. */
+    g_mutex_lock(&record_lock);
+    GQueue controls = record_controls;
+    g_queue_init(&record_controls);
+    g_mutex_unlock(&record_lock);
+    
+    while (tail != head) {
+        handle_record_controls(files, &controls, tail);
+        RecordHeader header;
+        ring_copy_out(tail, &header, sizeof(header));
+        char *data = g_malloc(header.length + 1);
+        ring_copy_out(tail + sizeof(header), data, header.length);
+        data[header.length] = '\0';
+        tail += sizeof(header) + header.length;
+        atomic_store_explicit(&record_tail, tail, memory_order_release);
+        
+        handle_record(files, &header, data);
+        g_free(data);
+    }
+    handle_record_controls(files, &controls, head);
+    
+    /* A stop queued past head waits until the next pass has drained the
+       events before it; later controls were queued after it. */
+    if (!g_queue_is_empty(&controls)) {
+        g_mutex_lock(&record_lock);
+        while (!g_queue_is_empty(&controls)) {
+            g_queue_push_head(&record_controls, g_queue_pop_tail(&controls));
+        }
+        g_mutex_unlock(&record_lock);
+    }
+    
+    /* Everything drained in one pass goes out as one write per file. */
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, files);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        write_record_file(value);
+    }
+}
+
+gpointer run_recorder(gpointer data) {
+    GHashTable *files = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)free_record_file);
+    gboolean stopping = FALSE;
+    
+    while (!stopping) {
+        g_mutex_lock(&record_lock);
+        if (!record_stopping && g_queue_is_empty(&record_controls)) {
+            /* Nothing to flush until a recording starts. */
+            if (g_hash_table_size(files) > 0) {
+                g_cond_wait_until(&record_wake, &record_lock, g_get_monotonic_time() + RECORD_FLUSH_MS * 1000);
+            } else {
+                g_cond_wait(&record_wake, &record_lock);
+            }
+        }
+        stopping = record_stopping;
+        g_mutex_unlock(&record_lock);
+        drain_records(files);
+    }
+    
+    g_hash_table_destroy(files);
+    return NULL;
+}
+
+void stop_recorder() {
+    if (!record_thread) return;
+    
+    g_mutex_lock(&record_lock);
+    record_stopping = TRUE;
+    g_cond_signal(&record_wake);
+    g_mutex_unlock(&record_lock);
+    g_thread_join(record_thread);
+    record_thread = NULL;
+    g_queue_clear_full(&record_controls, (GDestroyNotify)free_record_control);
+    g_clear_pointer(&record_ring, g_free);
+}
+
+void record_event(Tab *tab, RecordKind kind, const char *data, gsize length) {
+    if (tab->record_dropped) {
+        char *note = g_strdup_printf("dropped %" G_GSIZE_FORMAT " bytes", tab->record_dropped);
+        if (push_record(tab->recording, RECORD_MARKER, note, strlen(note))) {
+            tab->record_dropped = 0;
+        }
+        g_free(note);
+    }
+    if (tab->record_dropped || !push_record(tab->recording, kind, data, length)) {
+        tab->record_dropped += length;
+    }
+}
+
+void on_record_contents_changed(VteTerminal *terminal, gpointer user_data) {
+    Tab *tab = g_object_get_data(G_OBJECT(terminal), "tab");
+    glong row, col;
+    if (!tab || !tab->recording) return;
+    
+    /* Output is taken as the text between the cursor positions of two
+       updates; when the cursor moves back (clear, full-screen redraws)
+       the player's cursor is moved there too and recording carries on
+       from the new position. */
+    vte_terminal_get_cursor_position(terminal, &col, &row);
+    if (row < tab->record_row || (row == tab->record_row && col < tab->record_col)) {
+        GtkAdjustment *adjustment = gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(terminal));
+        glong top = (glong)gtk_adjustment_get_upper(adjustment) - vte_terminal_get_row_count(terminal);
+        char *move = g_strdup_printf("\033[%ld;%ldH", MAX(row - top, 0) + 1, col + 1);
+        record_event(tab, RECORD_OUTPUT, move, strlen(move));
+        g_free(move);
+    }
+    if (row < tab->record_row || (row == tab->record_row && col <= tab->record_col)) {
+        tab->record_row = row;
+        tab->record_col = col;
+        return;
+    }
+    
+    char *text = col > 0 ? get_terminal_text(terminal, tab->record_row, tab->record_col, row, col - 1)
+                         : get_terminal_text(terminal, tab->record_row, tab->record_col, row - 1,
+                                             vte_terminal_get_column_count(terminal) - 1);
+    if (text && *text) {
+        record_event(tab, RECORD_OUTPUT, text, strlen(text));
+    }
+    g_free(text);
+    tab->record_row = row;
+    tab->record_col = col;
+}
+
+void on_record_commit(VteTerminal *terminal, gchar *text, guint size, gpointer user_data) {
+    Tab *tab = g_object_get_data(G_OBJECT(terminal), "tab");
+    
+    /* Only the timing of input is kept, so typed passwords never reach
+       the recording. */
+    if (tab && tab->recording) {
+        record_event(tab, RECORD_INPUT, "", 0);
+    }
+}
+
+void start_tab_recording(Tab *tab) {
+    if (tab->recording || !tab->terminal) return;
+    
+    if (!record_thread) {
+        record_ring = g_malloc(RECORD_RING_SIZE);
+        record_stopping = FALSE;
+        record_thread = g_thread_new("recorder", run_recorder, NULL);
+    }
+    
+    VteTerminal *terminal = VTE_TERMINAL(tab->terminal);
+    GDateTime *now = g_date_time_new_now_local();
+    char *stamp = g_date_time_format(now, "%Y%m%d-%H%M%S");
+    char *name = g_strdup_printf("atermd-%s-%d-%u", stamp, getpid(), ++record_serial);
+    char *base = *record_dir ? g_build_filename(record_dir, name, NULL)
+                             : g_build_filename(g_get_user_data_dir(), RECORD_DIR, name, NULL);
+    char *start = g_strdup_printf("%d %d %ld %ld %s", record_compress, record_rotate_mb,
+                                  vte_terminal_get_column_count(terminal), vte_terminal_get_row_count(terminal), base);
+    
+    tab->recording = record_serial;
+    tab->record_dropped = 0;
+    queue_record_control(tab->recording, RECORD_START, start);
+    vte_terminal_get_cursor_position(terminal, &tab->record_col, &tab->record_row);
+    tab->record_output_handler = g_signal_connect(terminal, "contents-changed",
+                                                  G_CALLBACK(on_record_contents_changed), NULL);
+    tab->record_input_handler = g_signal_connect(terminal, "commit", G_CALLBACK(on_record_commit), NULL);
+    
+    g_free(start);
+    g_free(base);
+    g_free(name);
+    g_free(stamp);
+    g_date_time_unref(now);
+}
+
+void stop_tab_recording(Tab *tab) {
+    if (!tab->recording) return;
+    
+    g_signal_handler_disconnect(tab->terminal, tab->record_output_handler);
+    g_signal_handler_disconnect(tab->terminal, tab->record_input_handler);
+    queue_record_control(tab->recording, RECORD_STOP, "");
+    tab->recording = 0;
+}
+
+GtkWidget *ensure_terminal(Tab *tab);
+
+void on_record_toggled(GtkCheckMenuItem *item, gpointer data) {
+    Tab *tab = tab_at(gtk_notebook_get_current_page(GTK_NOTEBOOK(notebook)));
+    if (!tab) return;
+    
+    ensure_terminal(tab);
+    if (gtk_check_menu_item_get_active(item)) {
+        start_tab_recording(tab);
+    } else {
+        stop_tab_recording(tab);
+    }
+}
+
+GtkWidget *ensure_terminal(Tab *tab) {
+    if (!tab->terminal) {
+        tab->terminal = create_terminal_tab(tab);
+        g_signal_connect(tab->terminal, "button-press-event", G_CALLBACK(on_button_press), NULL);
+        g_signal_connect(tab->terminal, "child-exited", G_CALLBACK(on_child_exited), NULL);
+        g_signal_connect(tab->terminal, "bell", G_CALLBACK(on_tab_bell), NULL);
+        tab->activity_handler = g_signal_connect(tab->terminal, "contents-changed",
+                                                 G_CALLBACK(on_tab_contents_changed), NULL);
+        tab->activity_watched = TRUE;
+        g_signal_connect(tab->terminal, "contents-changed", G_CALLBACK(on_spill_contents_changed), NULL);
+        vte_terminal_set_cursor_blink_mode(VTE_TERMINAL(tab->terminal), VTE_CURSOR_BLINK_OFF);
+        gtk_box_pack_start(GTK_BOX(tab->page), tab->terminal, TRUE, TRUE, 0);
+        gtk_widget_show(tab->terminal);
+        apply_scrollback_policy();
+        if (record_all) {
+            start_tab_recording(tab);
+        }
+    }
+    return tab->terminal;
+}
+
+GtkWidget *current_terminal() {
+    return ensure_terminal(tab_at(gtk_notebook_get_current_page(GTK_NOTEBOOK(notebook))));
+}
+
+gint compare_tabs_by_last_viewed(gconstpointer a, gconstpointer b) {
+    const Tab *x = *(const Tab **)a;
+    const Tab *y = *(const Tab **)b;
+    return (x->last_viewed < y->last_viewed) - (x->last_viewed > y->last_viewed);
+}
+
+glong unspilled_rows(Tab *tab, glong keep_lines, glong *first) {
+    VteTerminal *vte_term = VTE_TERMINAL(tab->terminal);
+    GtkAdjustment *adjustment = gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(vte_term));
+    glong screen = (glong)gtk_adjustment_get_upper(adjustment) - vte_terminal_get_row_count(vte_term);
+    
+    *first = MAX((glong)gtk_adjustment_get_lower(adjustment), tab->spilled_row);
+    return screen - *first - keep_lines;
+}
+
+void spill_scrollback(Tab *tab, glong keep_lines) {
+    VteTerminal *vte_term = VTE_TERMINAL(tab->terminal);
+    glong first;
+    glong excess = unspilled_rows(tab, keep_lines, &first);
+    if (excess <= 0) return;
+    
+    char *text = get_terminal_text(vte_term, first, 0, first + excess - 1,
+                                   vte_terminal_get_column_count(vte_term) - 1);
+    tab->spilled_row = first + excess;
+    if (!text) return;
+    
+    if (!tab->spill_path) {
+        char *dir = g_build_filename(g_get_user_cache_dir(), SPILL_DIR, NULL);
+        char *name = g_strdup_printf("%d-%u.gz", getpid(), ++spill_serial);
+        g_mkdir_with_parents(dir, 0700);
+        tab->spill_path = g_build_filename(dir, name, NULL);
+        g_free(name);
+        g_free(dir);
+    }
+    queue_file_write(FILE_WRITE_APPEND_GZIP, tab->spill_path, text, strlen(text));
+}
+
+void remove_stale_spills() {
+    char *dir_path = g_build_filename(g_get_user_cache_dir(), SPILL_DIR, NULL);
+    GDir *dir = g_dir_open(dir_path, 0, NULL);
+    const char *name;
+    
+    /* Left behind by an atermd that crashed or was killed; they hold
+       terminal output, so they go as soon as nothing can read them. */
+    while (dir && (name = g_dir_read_name(dir))) {
+        int pid = atoi(name);
+        if (pid <= 0 || (pid != getpid() && kill(pid, 0) < 0 && errno == ESRCH)) {
+            char *path = g_build_filename(dir_path, name, NULL);
+            queue_file_write(FILE_WRITE_DELETE, path, NULL, 0);
+            g_free(path);
+        }
+    }
+    if (dir) {
+        g_dir_close(dir);
+    }
+    g_free(dir_path);
+}
+
+void on_spill_contents_changed(VteTerminal *terminal, gpointer user_data) {
+    Tab *tab = g_object_get_data(G_OBJECT(terminal), "tab");
+    glong first;
+    if (!tab || !scrollback_spill) return;
+    
+    /* Lines are saved in batches once they reach the older half of the
+       scrollback, before VTE drops them at the limit. */
+    glong keep_lines = tab->scrollback_lines / 2;
+    if (unspilled_rows(tab, keep_lines, &first) >= SPILL_BATCH_ROWS) {
+        spill_scrollback(tab, keep_lines);
+    }
+}
+
+void set_tab_scrollback(Tab *tab, glong lines) {
+    if (lines == tab->scrollback_lines) return;
+    
+    if (lines < tab->scrollback_lines && scrollback_spill) {
+        spill_scrollback(tab, lines);
     }
+    vte_terminal_set_scrollback_lines(VTE_TERMINAL(tab->terminal), lines);
+    tab->scrollback_lines = lines;
 }
 
-gboolean on_button_press(GtkWidget *widget, GdkEventButton *event, gpointer user_data) {
-    if (event->button == GDK_BUTTON_SECONDARY) {
-        show_context_menu(widget);
-        return TRUE;
+void apply_scrollback_policy() {
+    GPtrArray *live = g_ptr_array_new();
+    for (guint i = 0; i < tabs->len; i++) {
+        Tab *tab = g_ptr_array_index(tabs, i);
+        if (tab->terminal) {
+            g_ptr_array_add(live, tab);
+        }
     }
-    return FALSE;
+    g_ptr_array_sort(live, compare_tabs_by_last_viewed);
+    
+    /* Most recently viewed tabs take their share of the budget first, so
+       the ones nobody has looked at in a while are trimmed first. */
+    gint64 budget = (gint64)scrollback_budget_mb * 1024 * 1024;
+    glong min_lines = MIN(SCROLLBACK_MIN_LINES, scrollback_lines);
+    for (guint i = 0; i < live->len; i++) {
+        Tab *tab = g_ptr_array_index(live, i);
+        gint64 line_bytes = MAX(vte_terminal_get_column_count(VTE_TERMINAL(tab->terminal)), 1) *
+                            SCROLLBACK_CELL_BYTES;
+        glong lines = (glong)MIN((gint64)scrollback_lines, budget / line_bytes);
+        
+        lines = MAX(lines, min_lines);
+        budget = MAX(budget - lines * line_bytes, 0);
+        set_tab_scrollback(tab, lines);
+    }
+    g_ptr_array_free(live, TRUE);
 }
 
-GtkWidget *create_header_bar() {
-    GtkWidget *header = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
-    gtk_widget_set_size_request(header, -1, 32);
-    
-    GtkCssProvider *css_provider = gtk_css_provider_new();
-    gtk_css_provider_load_from_data(css_provider,
-        "box {"
-        "  background: #000033;"
-        "  border-bottom: 2px solid #00FFFF;"
-        "  color: #00FFFF;"
-        "  padding: 0 12px;"
-        "  font-family: 'Courier New', monospace;"
-        "  font-weight: bold;"
-        "}", -1, NULL);
-    gtk_style_context_add_provider(gtk_widget_get_style_context(header),
-                                  GTK_STYLE_PROVIDER(css_provider),
-                                  GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
+void show_spilled_scrollback(Tab *tab) {
+    Tab *pager = add_tab();
+    char *argv[] = { "sh", "-c", "gzip -dc -- \"$1\" | less +G", "sh", tab->spill_path, NULL };
+    pager->argv = g_strdupv(argv);
+    switch_to_tab(tabs->len - 1);
+}
+
+gboolean tab_scrolled_to_top(Tab *tab) {
+    GtkAdjustment *adjustment = gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(tab->terminal));
+    return gtk_adjustment_get_value(adjustment) <= gtk_adjustment_get_lower(adjustment);
+}
+
+Tab *add_tab() {
+    Tab *tab = g_new0(Tab, 1);
+    tab->page = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+    g_object_set_data(G_OBJECT(tab->page), "tab", tab);
+    gtk_widget_show(tab->page);
     
-    tab_info_label = gtk_label_new("ATermD - 1/10 | ALT+1..0");
-    gtk_widget_set_halign(tab_info_label, GTK_ALIGN_START);
-    gtk_widget_set_valign(tab_info_label, GTK_ALIGN_CENTER);
+    g_ptr_array_add(tabs, tab);
+    gtk_notebook_append_page(GTK_NOTEBOOK(notebook), tab->page, NULL);
+    return tab;
+}
+
+void switch_to_tab(int tab_num) {
+    Tab *tab = tab_at(tab_num);
+    if (tab) {
+        tab->last_viewed = g_get_monotonic_time();
+        ensure_terminal(tab);
+        apply_terminal_font(tab);
+        for (guint i = 0; i < tabs->len; i++) {
+            Tab *other = g_ptr_array_index(tabs, i);
+            set_tab_foreground(other, other == tab);
+        }
+        gtk_notebook_set_current_page(GTK_NOTEBOOK(notebook), tab_num);
+        gtk_widget_grab_focus(tab->terminal);
+        apply_scrollback_policy();
+        update_tab_info();
+    }
+}
+
+void run_in_new_tab(char **argv, const char *workdir, const char *launch_id) {
+    Tab *tab = add_tab();
+    const char *path = resolve_program(argv[0]);
     
-    clock_label = gtk_label_new("");
-    gtk_widget_set_halign(clock_label, GTK_ALIGN_END);
-    gtk_widget_set_valign(clock_label, GTK_ALIGN_CENTER);
-    update_clock();
-    g_timeout_add_seconds(1, on_clock_tick, NULL);
+    tab->argv = g_strdupv(argv);
+    if (path && path != argv[0]) {
+        g_free(tab->argv[0]);
+        tab->argv[0] = g_strdup(path);
+    }
+    tab->workdir = g_strdup(workdir);
+    tab->launch_id = g_strdup(launch_id);
+    switch_to_tab(tabs->len - 1);
+}
+
+void new_tab() {
+    add_tab();
+    switch_to_tab(tabs->len - 1);
+}
+
+void on_closed_child_reaped(GPid pid, gint status, gpointer user_data) {
+    g_spawn_close_pid(pid);
+}
+
+void free_tab(Tab *tab) {
+    free_transfer(tab->transfer);
+    if (tab->spill_path) {
+        queue_file_write(FILE_WRITE_DELETE, tab->spill_path, NULL, 0);
+        g_free(tab->spill_path);
+    }
+    g_strfreev(tab->argv);
+    g_free(tab->workdir);
+    g_free(tab->launch_id);
+    g_free(tab);
+}
+
+void free_tabs() {
+    for (guint i = 0; i < tabs->len; i++) {
+        free_tab(g_ptr_array_index(tabs, i));
+    }
+    g_ptr_array_free(tabs, TRUE);
+    tabs = NULL;
+}
+
+void close_tab(Tab *tab) {
+    /* Destroying the VTE widget drops its scrollback and PTY and hangs up
+       the shell; reap it here since VTE stops watching it. */
+    if (tab->pid > 0) {
+        g_child_watch_add(tab->pid, on_closed_child_reaped, NULL);
+    }
+    finish_transfer(tab, TRUE);
+    if (tab->terminal) {
+        stop_tab_recording(tab);
+        g_object_set_data(G_OBJECT(tab->terminal), "tab", NULL);
+        g_signal_handlers_disconnect_by_func(tab->terminal, on_child_exited, NULL);
+    }
     
-    gtk_box_pack_start(GTK_BOX(header), tab_info_label, FALSE, FALSE, 0);
-    gtk_box_pack_end(GTK_BOX(header), clock_label, FALSE, FALSE, 0);
+    g_ptr_array_remove(tabs, tab);
+    gtk_notebook_remove_page(GTK_NOTEBOOK(notebook),
+                             gtk_notebook_page_num(GTK_NOTEBOOK(notebook), tab->page));
+    free_tab(tab);
     
-    return header;
+    if (tabs->len == 0) {
+        add_tab();
+    }
+    switch_to_tab(gtk_notebook_get_current_page(GTK_NOTEBOOK(notebook)));
 }
 
-void switch_to_tab(int tab_num) {
-    if (tab_num >= 0 && tab_num < TAB_COUNT) {
-        gtk_notebook_set_current_page(GTK_NOTEBOOK(notebook), tab_num);
-        update_tab_info(tab_num);
+void close_current_tab() {
+    close_tab(tab_at(gtk_notebook_get_current_page(GTK_NOTEBOOK(notebook))));
+}
+
+void on_child_exited(VteTerminal *terminal, int status, gpointer user_data) {
+    Tab *tab = g_object_get_data(G_OBJECT(terminal), "tab");
+    if (tab) {
+        tab->pid = 0;
+        close_tab(tab);
+    }
+    schedule_pool_refill();
+}
+
+gboolean prewarm_next_tab(gpointer data) {
+    while (prewarm_next < prewarm_count) {
+        Tab *tab = tab_at(prewarm_tabs[prewarm_next++] - 1);
+        if (tab && !tab->terminal) {
+            ensure_terminal(tab);
+            return G_SOURCE_CONTINUE;
+        }
+    }
+    return G_SOURCE_REMOVE;
+}
+
+gboolean on_prewarm_delay(gpointer data) {
+    g_idle_add_full(G_PRIORITY_LOW, prewarm_next_tab, NULL, NULL);
+    return G_SOURCE_REMOVE;
+}
+
+void toggle_window() {
+    if (gtk_widget_get_visible(window)) {
+        gtk_widget_hide(window);
+    } else {
+        gtk_widget_show_all(window);
     }
 }
 
@@ -439,19 +3531,20 @@ gboolean on_key_press(GtkWidget *widget, GdkEventKey *event, gpointer user_data)
         } else if (event->keyval == GDK_KEY_0) {
             switch_to_tab(9);
             return TRUE;
+        } else if (event->keyval == GDK_KEY_t || event->keyval == GDK_KEY_T) {
+            new_tab();
+            return TRUE;
+        } else if (event->keyval == GDK_KEY_w || event->keyval == GDK_KEY_W) {
+            close_current_tab();
+            return TRUE;
         } else if (event->keyval == GDK_KEY_d || event->keyval == GDK_KEY_D) {
             show_amenu();
             return TRUE;
         } else if (event->keyval == GDK_KEY_h || event->keyval == GDK_KEY_H) {
-            if (gtk_widget_get_visible(window)) {
-                gtk_widget_hide(window);
-            } else {
-                gtk_widget_show_all(window);
-            }
+            toggle_window();
             return TRUE;
         } else if (event->keyval == GDK_KEY_l || event->keyval == GDK_KEY_L) {
-            int current_page = gtk_notebook_get_current_page(GTK_NOTEBOOK(notebook));
-            vte_terminal_reset(VTE_TERMINAL(terminal_tabs[current_page]), TRUE, TRUE);
+            vte_terminal_reset(VTE_TERMINAL(current_terminal()), TRUE, TRUE);
             return TRUE;
         }
     }
@@ -466,6 +3559,14 @@ gboolean on_key_press(GtkWidget *widget, GdkEventKey *event, gpointer user_data)
         }
     }
     
+    if ((event->state & GDK_SHIFT_MASK) && event->keyval == GDK_KEY_Page_Up && widget == window) {
+        Tab *tab = tab_at(gtk_notebook_get_current_page(GTK_NOTEBOOK(notebook)));
+        if (tab && tab->terminal && tab->spill_path && tab_scrolled_to_top(tab)) {
+            show_spilled_scrollback(tab);
+            return TRUE;
+        }
+    }
+    
     if (event->keyval == GDK_KEY_Super_L || event->keyval == GDK_KEY_Super_R) {
         launch_obconf(NULL, NULL);
         return TRUE;
@@ -479,30 +3580,545 @@ gboolean on_key_press(GtkWidget *widget, GdkEventKey *event, gpointer user_data)
     return FALSE;
 }
 
-void load_config() {
-    char *config_dir = g_build_filename(g_get_home_dir(), CONFIG_FILE, NULL);
-    char *dir_path = g_path_get_dirname(config_dir);
+int config_get_integer(const char *group, const char *key, int fallback) {
+    GError *error = NULL;
+    int value = g_key_file_get_integer(config, group, key, &error);
+    if (error) {
+        g_error_free(error);
+        return fallback;
+    }
+    return value;
+}
+
+gboolean config_get_boolean(const char *group, const char *key, gboolean fallback) {
+    GError *error = NULL;
+    gboolean value = g_key_file_get_boolean(config, group, key, &error);
+    if (error) {
+        g_error_free(error);
+        return fallback;
+    }
+    return value;
+}
+
+char *config_get_string(const char *group, const char *key, const char *fallback) {
+    char *value = g_key_file_get_string(config, group, key, NULL);
+    return value ? value : g_strdup(fallback);
+}
+
+int *config_get_integer_list(const char *group, const char *key, gsize *length) {
+    int *value = g_key_file_get_integer_list(config, group, key, length, NULL);
+    if (!value) *length = 0;
+    return value;
+}
+
+void save_config() {
+    gsize length;
+    char *data = g_key_file_to_data(config, &length, NULL);
+    
+    g_free(config_saved_data);
+    config_saved_data = g_strdup(data);
+    write_file_async(config_path, data, length);
+}
+
+gboolean on_config_save(gpointer data) {
+    config_save_id = 0;
+    save_config();
+    return G_SOURCE_REMOVE;
+}
+
+void schedule_config_save() {
+    if (config_save_id) {
+        g_source_remove(config_save_id);
+    }
+    config_save_id = g_timeout_add(CONFIG_SAVE_DELAY, on_config_save, NULL);
+}
+
+void config_set_integer(const char *group, const char *key, int value) {
+    g_key_file_set_integer(config, group, key, value);
+    schedule_config_save();
+}
+
+void config_set_boolean(const char *group, const char *key, gboolean value) {
+    g_key_file_set_boolean(config, group, key, value);
+    schedule_config_save();
+}
+
+void config_set_string(const char *group, const char *key, const char *value) {
+    g_key_file_set_string(config, group, key, value);
+    schedule_config_save();
+}
+
+void flush_config() {
+    if (config_save_id) {
+        g_source_remove(config_save_id);
+        config_save_id = 0;
+        save_config();
+    }
+}
+
+void configure_trace() {
+    const char *env = g_getenv("ATERMD_TRACE");
+    char *file = NULL;
+    
+    g_clear_pointer(&trace_path, g_free);
+    if (env && *env && strcmp(env, "0") != 0) {
+        file = g_strdup(strcmp(env, "1") == 0 ? "" : env);
+    } else if (config_get_boolean("Trace", "enabled", FALSE)) {
+        file = config_get_string("Trace", "file", "");
+    }
+    if (file) {
+        trace_path = *file ? g_strdup(file) : g_build_filename(g_get_user_runtime_dir(), TRACE_FILE, NULL);
+        g_free(file);
+    }
+    
+    if (trace_startup_done) {
+        trace_enabled = trace_path != NULL;
+    }
+}
+
+void read_settings() {
+    current_font_size = config_get_integer("Settings", "font_size", 16);
+    if (current_font_size < MIN_FONT_SIZE || current_font_size > MAX_FONT_SIZE) {
+        current_font_size = 16;
+    }
+    
+    g_free(prewarm_tabs);
+    prewarm_tabs = config_get_integer_list("Tabs", "prewarm", &prewarm_count);
+    
+    scrollback_lines = MAX(config_get_integer("Scrollback", "lines", SCROLLBACK_LINES), 0);
+    scrollback_budget_mb = MAX(config_get_integer("Scrollback", "budget_mb", SCROLLBACK_BUDGET_MB), 1);
+    scrollback_spill = config_get_boolean("Scrollback", "spill", FALSE);
+    
+    g_free(shell_command);
+    shell_command = config_get_string("Settings", "shell", "");
+    pool_size = CLAMP(config_get_integer("Pool", "size", POOL_SIZE), 0, POOL_MAX_SIZE);
+    pool_min_available_mb = MAX(config_get_integer("Pool", "min_available_mb", POOL_MIN_AVAILABLE_MB), 0);
+    
+    g_free(status_modules_setting);
+    status_modules_setting = config_get_string("StatusBar", "modules", STATUS_MODULES);
+    
+    record_all = config_get_boolean("Recording", "enabled", FALSE);
+    g_free(record_dir);
+    record_dir = config_get_string("Recording", "dir", "");
+    record_compress = config_get_boolean("Recording", "compress", TRUE);
+    record_rotate_mb = MAX(config_get_integer("Recording", "rotate_mb", RECORD_ROTATE_MB), 0);
+    
+    configure_trace();
+}
+
+void apply_config() {
+    int old_font_size = current_font_size;
+    char *old_shell = g_strdup(get_shell());
+    char *old_status_modules = g_strdup(status_modules_setting);
     
-    if (g_mkdir_with_parents(dir_path, 0755) == -1) {
-        g_free(dir_path);
-        g_free(config_dir);
+    read_settings();
+    if (current_font_size != old_font_size) {
+        update_terminal_font();
+    }
+    apply_scrollback_policy();
+    
+    if (strcmp(old_shell, get_shell()) != 0) {
+        trim_shell_pool(0);
+    }
+    trim_shell_pool(pool_size);
+    pool_failures = 0;
+    schedule_pool_refill();
+    g_free(old_shell);
+    
+    if (g_strcmp0(old_status_modules, status_modules_setting) != 0) {
+        build_status_modules();
+    }
+    g_free(old_status_modules);
+    
+    for (guint i = 0; record_all && i < tabs->len; i++) {
+        start_tab_recording(g_ptr_array_index(tabs, i));
+    }
+}
+
+void reload_config() {
+    char *data;
+    gsize length;
+    
+    if (!g_file_get_contents(config_path, &data, &length, NULL)) return;
+    if (g_strcmp0(data, config_saved_data) == 0) {
+        g_free(data);
+        return;
+    }
+    
+    GKeyFile *key_file = g_key_file_new();
+    if (!g_key_file_load_from_data(key_file, data, length, G_KEY_FILE_KEEP_COMMENTS, NULL)) {
+        g_key_file_free(key_file);
+        g_free(data);
         return;
     }
+    
+    /* An external edit wins over changes we have not written yet. */
+    if (config_save_id) {
+        g_source_remove(config_save_id);
+        config_save_id = 0;
+    }
+    g_key_file_free(config);
+    config = key_file;
+    g_free(config_saved_data);
+    config_saved_data = data;
+    
+    apply_config();
+}
+
+void on_config_changed(GFileMonitor *monitor, GFile *file, GFile *other_file,
+                       GFileMonitorEvent event_type, gpointer user_data) {
+    if (event_type == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT ||
+        event_type == G_FILE_MONITOR_EVENT_CREATED) {
+        reload_config();
+    }
+}
+
+void load_config() {
+    config_path = g_build_filename(g_get_home_dir(), CONFIG_FILE, NULL);
+    char *dir_path = g_path_get_dirname(config_path);
+    g_mkdir_with_parents(dir_path, 0755);
     g_free(dir_path);
     
     config = g_key_file_new();
-    g_key_file_load_from_file(config, config_dir, G_KEY_FILE_NONE, NULL);
+    if (g_file_get_contents(config_path, &config_saved_data, NULL, NULL)) {
+        g_key_file_load_from_data(config, config_saved_data, -1, G_KEY_FILE_KEEP_COMMENTS, NULL);
+    }
+    read_settings();
     
-    current_font_size = g_key_file_get_integer(config, "Settings", "font_size", NULL);
-    if (current_font_size < MIN_FONT_SIZE || current_font_size > MAX_FONT_SIZE) {
-        current_font_size = 16;
+    GFile *file = g_file_new_for_path(config_path);
+    config_monitor = g_file_monitor_file(file, G_FILE_MONITOR_NONE, NULL, NULL);
+    if (config_monitor) {
+        g_signal_connect(config_monitor, "changed", G_CALLBACK(on_config_changed), NULL);
+    }
+    g_object_unref(file);
+}
+
+void free_config() {
+    g_clear_object(&config_monitor);
+    g_clear_pointer(&config, g_key_file_free);
+    g_clear_pointer(&config_path, g_free);
+    g_clear_pointer(&config_saved_data, g_free);
+}
+
+gboolean run_control_command(const char *command, GError **error) {
+    if (strcmp(command, "ping") == 0) {
+        return TRUE;
+    }
+    if (strcmp(command, "toggle") == 0) {
+        toggle_window();
+        return TRUE;
+    }
+    if (strcmp(command, "amenu") == 0) {
+        show_amenu();
+        return TRUE;
+    }
+    /* Only for bench/atermd-bench.py, which sets ATERMD_BENCH. */
+    if (bench_commands && g_str_has_prefix(command, "amenu-query ")) {
+        if (!amenu_window || !gtk_widget_get_visible(amenu_window)) {
+            show_amenu();
+        }
+        gtk_entry_set_text(GTK_ENTRY(amenu_entry), command + strlen("amenu-query "));
+        return TRUE;
+    }
+    if (bench_commands && strcmp(command, "context-menu") == 0) {
+        if (context_menu && gtk_widget_get_visible(context_menu)) {
+            gtk_menu_popdown(GTK_MENU(context_menu));
+        }
+        show_context_menu(window);
+        return TRUE;
+    }
+    if (bench_commands && g_str_has_prefix(command, "font ")) {
+        change_font_size(atoi(command + strlen("font ")));
+        return TRUE;
+    }
+    if (strcmp(command, "quit") == 0) {
+        gtk_main_quit();
+        return TRUE;
+    }
+    
+    if (strcmp(command, "new-tab") == 0) {
+        new_tab();
+    } else if (g_str_has_prefix(command, "run ")) {
+        char **argv;
+        if (!g_shell_parse_argv(command + strlen("run "), NULL, &argv, error)) return FALSE;
+        run_in_new_tab(argv, NULL, NULL);
+        g_strfreev(argv);
+    } else if (g_str_has_prefix(command, "switch ")) {
+        int tab_num = atoi(command + strlen("switch "));
+        if (tab_num < 1 || tab_num > (int)tabs->len) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "No tab %d", tab_num);
+            return FALSE;
+        }
+        switch_to_tab(tab_num - 1);
+    } else {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "Unknown command: %s", command);
+        return FALSE;
+    }
+    
+    if (!gtk_widget_get_visible(window)) {
+        gtk_widget_show_all(window);
+    }
+    return TRUE;
+}
+
+void run_control_commands(const char *commands) {
+    char **lines = g_strsplit(commands, "\n", -1);
+    for (char **line = lines; *line; line++) {
+        GError *error = NULL;
+        if (**line && !run_control_command(*line, &error)) {
+            g_printerr("atermd: %s\n", error->message);
+            g_error_free(error);
+        }
+    }
+    g_strfreev(lines);
+}
+
+void free_control_client(ControlClient *client) {
+    g_io_stream_close(G_IO_STREAM(client->connection), NULL, NULL);
+    g_object_unref(client->input);
+    g_object_unref(client->connection);
+    g_free(client->reply);
+    g_free(client);
+}
+
+void on_control_line(GObject *source, GAsyncResult *result, gpointer user_data);
+
+void on_control_reply_written(GObject *source, GAsyncResult *result, gpointer user_data) {
+    ControlClient *client = user_data;
+    gboolean written = g_output_stream_write_all_finish(G_OUTPUT_STREAM(source), result, NULL, NULL);
+    g_clear_pointer(&client->reply, g_free);
+    if (!written) {
+        free_control_client(client);
+        return;
+    }
+    g_data_input_stream_read_line_async(client->input, G_PRIORITY_DEFAULT, NULL, on_control_line, client);
+}
+
+void on_control_line(GObject *source, GAsyncResult *result, gpointer user_data) {
+    ControlClient *client = user_data;
+    char *line = g_data_input_stream_read_line_finish(client->input, result, NULL, NULL);
+    if (!line) {
+        free_control_client(client);
+        return;
+    }
+    
+    GError *error = NULL;
+    char *reply = run_control_command(line, &error) ? g_strdup("ok\n") :
+                  g_strdup_printf("error %s\n", error->message);
+    g_clear_error(&error);
+    g_free(line);
+    
+    /* A client that stops reading must not stall the main loop; the
+       next line is read once the reply has gone out. */
+    client->reply = reply;
+    GOutputStream *output = g_io_stream_get_output_stream(G_IO_STREAM(client->connection));
+    g_output_stream_write_all_async(output, reply, strlen(reply), G_PRIORITY_DEFAULT, NULL,
+                                    on_control_reply_written, client);
+}
+
+gboolean on_control_incoming(GSocketService *service, GSocketConnection *connection,
+                             GObject *source_object, gpointer user_data) {
+    ControlClient *client = g_new0(ControlClient, 1);
+    client->connection = g_object_ref(connection);
+    client->input = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+    g_data_input_stream_read_line_async(client->input, G_PRIORITY_DEFAULT, NULL, on_control_line, client);
+    return TRUE;
+}
+
+int connect_control_socket() {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(control_socket_path) >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, control_socket_path);
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        fd = -1;
+    }
+    return fd;
+}
+
+int listen_control_socket() {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(control_socket_path) >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, control_socket_path);
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0)) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+int send_control_commands(int fd, const char *commands) {
+    struct timeval timeout = { CONTROL_TIMEOUT, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    
+    size_t length = strlen(commands);
+    for (size_t sent = 0; sent < length; ) {
+        ssize_t n = write(fd, commands + sent, length - sent);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "atermd: failed to send command: %s\n", strerror(errno));
+            return 1;
+        }
+        sent += n;
+    }
+    shutdown(fd, SHUT_WR);
+    
+    /* One reply line comes back per command. */
+    int status = 0;
+    char reply[1024];
+    GString *pending = g_string_new(NULL);
+    ssize_t n;
+    while ((n = read(fd, reply, sizeof(reply))) > 0 || (n < 0 && errno == EINTR)) {
+        if (n > 0) g_string_append_len(pending, reply, n);
+    }
+    char **lines = g_strsplit(pending->str, "\n", -1);
+    for (char **line = lines; *line; line++) {
+        if (g_str_has_prefix(*line, "error ")) {
+            fprintf(stderr, "atermd: %s\n", *line + strlen("error "));
+            status = 1;
+        }
+    }
+    g_strfreev(lines);
+    g_string_free(pending, TRUE);
+    return status;
+}
+
+int claim_control_socket(const char *commands, int *status) {
+    /* The first instance owns the socket; later ones hand their commands
+       to it and exit. A socket nobody answers on is left over from a
+       crash and is replaced. */
+    control_socket_path = g_build_filename(g_get_user_runtime_dir(), CONTROL_SOCKET, NULL);
+    
+    int fd = connect_control_socket();
+    if (fd < 0) {
+        /* Two instances starting together would otherwise both see the
+           stale socket, and the second would unlink the one the first
+           just bound. Whoever loses the lock retries the connect. */
+        char *lock_path = g_build_filename(g_get_user_runtime_dir(), CONTROL_LOCK, NULL);
+        int lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        g_free(lock_path);
+        if (lock_fd >= 0) {
+            while (flock(lock_fd, LOCK_EX) < 0 && errno == EINTR);
+        }
+        
+        fd = connect_control_socket();
+        if (fd < 0) {
+            if (errno == ECONNREFUSED) {
+                unlink(control_socket_path);
+            }
+            fd = listen_control_socket();
+            if (lock_fd >= 0) close(lock_fd);
+            if (fd >= 0) return fd;
+        } else if (lock_fd >= 0) {
+            close(lock_fd);
+        }
     }
+    if (fd >= 0) {
+        *status = send_control_commands(fd, commands);
+        close(fd);
+        return -1;
+    }
+    
+    g_warning("Could not claim %s; running without single-instance control", control_socket_path);
+    g_clear_pointer(&control_socket_path, g_free);
+    *status = -1;
+    return -1;
+}
+
+void start_control_service(int fd) {
+    GError *error = NULL;
+    GSocket *socket = g_socket_new_from_fd(fd, &error);
+    
+    if (socket) {
+        control_service = g_socket_service_new();
+        if (g_socket_listener_add_socket(G_SOCKET_LISTENER(control_service), socket, NULL, &error)) {
+            g_signal_connect(control_service, "incoming", G_CALLBACK(on_control_incoming), NULL);
+            g_socket_service_start(control_service);
+        }
+        g_object_unref(socket);
+    }
+    if (error) {
+        g_warning("Failed to start control socket: %s", error->message);
+        g_error_free(error);
+    }
+}
+
+void stop_control_service() {
+    if (control_service) {
+        g_socket_service_stop(control_service);
+        g_socket_listener_close(G_SOCKET_LISTENER(control_service));
+        g_clear_object(&control_service);
+        unlink(control_socket_path);
+    }
+    g_clear_pointer(&control_socket_path, g_free);
+}
+
+void print_usage() {
+    printf("Usage: atermd [OPTION...]\n"
+           "\n"
+           "Starts the ATermD desktop, or passes the options to the one already running.\n"
+           "\n"
+           "  --new-tab     Open a new tab\n"
+           "  --run CMD     Run CMD in a new tab\n"
+           "  --switch N    Switch to tab N\n"
+           "  --toggle      Hide or show the desktop\n"
+           "  --amenu       Open AmenuD\n"
+           "  --quit        Quit the running instance\n");
+}
+
+GString *parse_control_args(int *argc, char **argv) {
+    GString *commands = g_string_new(NULL);
+    int kept = 1;
     
-    g_free(config_dir);
+    for (int i = 1; i < *argc; i++) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--new-tab") == 0) {
+            g_string_append(commands, "new-tab\n");
+        } else if (strcmp(arg, "--toggle") == 0) {
+            g_string_append(commands, "toggle\n");
+        } else if (strcmp(arg, "--amenu") == 0) {
+            g_string_append(commands, "amenu\n");
+        } else if (strcmp(arg, "--quit") == 0) {
+            g_string_append(commands, "quit\n");
+        } else if ((strcmp(arg, "--run") == 0 || strcmp(arg, "--switch") == 0) && i + 1 < *argc) {
+            if (strchr(argv[i + 1], '\n')) {
+                fprintf(stderr, "atermd: %s argument must be a single line\n", arg);
+                g_string_free(commands, TRUE);
+                return NULL;
+            }
+            g_string_append_printf(commands, "%s %s\n", arg + 2, argv[++i]);
+        } else if (strcmp(arg, "--help") == 0 || strcmp(arg, "-h") == 0) {
+            print_usage();
+            exit(0);
+        } else {
+            /* Left for gtk_init(), which knows options like --display. */
+            argv[kept++] = argv[i];
+        }
+    }
+    argv[kept] = NULL;
+    *argc = kept;
+    return commands;
 }
 
 void setup_main_window() {
+    gint64 trace = trace_begin();
     load_config();
+    trace_end("load_config", trace);
+    
+    trace = trace_begin();
+    load_history();
+    trace_end("load_history", trace);
+    
+    trace = trace_begin();
+    build_app_index();
+    trace_end("build_app_index", trace);
     
     window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
     gtk_window_set_title(GTK_WINDOW(window), "ATermD - Retro Terminal with Tabs");
@@ -510,6 +4126,9 @@ void setup_main_window() {
     gtk_window_set_decorated(GTK_WINDOW(window), FALSE);
     gtk_window_set_keep_below(GTK_WINDOW(window), TRUE);
     g_signal_connect(window, "destroy", G_CALLBACK(gtk_main_quit), NULL);
+    g_signal_connect_after(window, "draw", G_CALLBACK(on_first_draw), NULL);
+    g_signal_connect(window, "map-event", G_CALLBACK(on_window_map_event), NULL);
+    g_signal_connect(window, "unmap-event", G_CALLBACK(on_window_unmap_event), NULL);
     
     set_window_properties(window);
     
@@ -524,15 +4143,22 @@ void setup_main_window() {
     gtk_notebook_set_show_border(GTK_NOTEBOOK(notebook), FALSE);
     gtk_box_pack_end(GTK_BOX(main_box), notebook, TRUE, TRUE, 0);
     
+    remove_stale_spills();
+    tabs = g_ptr_array_new();
     for (int i = 0; i < TAB_COUNT; i++) {
-        terminal_tabs[i] = create_terminal_tab(i);
-        gtk_notebook_append_page(GTK_NOTEBOOK(notebook), terminal_tabs[i], NULL);
-        
-        g_signal_connect(terminal_tabs[i], "button-press-event", G_CALLBACK(on_button_press), NULL);
+        add_tab();
+    }
+    ensure_terminal(tab_at(0));
+    update_tab_info();
+    
+    if (prewarm_count > 0) {
+        g_timeout_add_seconds(PREWARM_DELAY, on_prewarm_delay, NULL);
     }
+    schedule_pool_refill();
     
     g_signal_connect(window, "key-press-event", G_CALLBACK(on_key_press), NULL);
     
+    trace = trace_begin();
     GtkCssProvider *css_provider = gtk_css_provider_new();
     gtk_css_provider_load_from_data(css_provider,
         "window {"
@@ -552,20 +4178,72 @@ void setup_main_window() {
     gtk_style_context_add_provider_for_screen(gdk_screen_get_default(),
                                             GTK_STYLE_PROVIDER(css_provider),
                                             GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
+    trace_end("css_provider", trace);
     
     clipboard = gtk_clipboard_get(GDK_SELECTION_CLIPBOARD);
 }
 
 int main(int argc, char *argv[]) {
+    trace_origin = g_get_monotonic_time();
+    bench_commands = g_getenv("ATERMD_BENCH") != NULL;
+    
+    GString *commands = parse_control_args(&argc, argv);
+    if (!commands) return 2;
+    
+    int status;
+    int control_fd = claim_control_socket(commands->str, &status);
+    if (control_fd < 0 && status >= 0) {
+        g_string_free(commands, TRUE);
+        return status;
+    }
+    if (control_fd >= 0 && strcmp(commands->str, "quit\n") == 0) {
+        /* Nothing was running to quit. */
+        close(control_fd);
+        unlink(control_socket_path);
+        return 0;
+    }
+    trace_end("claim_control_socket", trace_origin);
+    
+    gint64 trace = trace_begin();
     gtk_init(&argc, &argv);
+    trace_end("gtk_init", trace);
     
+    trace = trace_begin();
     setup_main_window();
+    trace_end("setup_main_window", trace);
     
+    if (control_fd >= 0) {
+        start_control_service(control_fd);
+    }
+    
+    trace = trace_begin();
     gtk_widget_show_all(window);
+    trace_end("show_all", trace);
+    
+    run_control_commands(commands->str);
+    g_string_free(commands, TRUE);
     gtk_main();
     
-    if (config) {
-        g_key_file_free(config);
+    if (trace_enabled) {
+        trace_dump();
+    }
+    stop_control_service();
+    flush_config();
+    free_shell_pool();
+    stop_recorder();
+    free_tabs();
+    flush_history();
+    free_config();
+    g_clear_pointer(&terminal_font, pango_font_description_free);
+    free_app_index();
+    free_icon_loader();
+    free_status_modules();
+    g_free(prewarm_tabs);
+    g_free(shell_command);
+    g_free(record_dir);
+    g_free(trace_path);
+    if (trace_events) {
+        g_array_free(trace_events, TRUE);
     }
     
     return 0;